@@ -0,0 +1,90 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+/** @class BoundedQueue
+*   @brief First-in first-out queue of limited capacity connecting two threads.
+*   @details push() blocks while the queue is full and pop() blocks while it is empty.
+*	Once the queue is closed, push() fails immediately and pop() fails after the remaining items are consumed.
+*/
+template<typename T>
+class BoundedQueue
+{
+public:
+	/// Ctor
+	/// @param[in] capacity maximum number of items in the queue, at least 1
+	explicit BoundedQueue(std::size_t capacity) :
+		capacity_(capacity > 0 ? capacity : 1),
+		isClosed_(false)
+	{
+	}
+
+	/// adds an item at the end of the queue, waiting for space if the queue is full
+	/// @param[in] item item to add
+	/// @return false if the queue was closed, in which case item is dropped
+	bool push(T item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		notFull_.wait(lock, [this]{ return isClosed_ || items_.size() < capacity_; });
+		if (isClosed_)
+			return false;
+		items_.push_back(std::move(item));
+		notEmpty_.notify_one();
+		return true;
+	}
+
+	/// removes the item at the front of the queue, waiting for one if the queue is empty
+	/// @param[out] item the removed item
+	/// @return false if the queue is closed and empty
+	bool pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		notEmpty_.wait(lock, [this]{ return isClosed_ || !items_.empty(); });
+		if (items_.empty())
+			return false;
+		item = std::move(items_.front());
+		items_.pop_front();
+		notFull_.notify_one();
+		return true;
+	}
+
+	/// closes the queue, waking up all waiting threads
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		isClosed_ = true;
+		notFull_.notify_all();
+		notEmpty_.notify_all();
+	}
+
+private:
+	BoundedQueue(const BoundedQueue& that) = delete; //disable copy constructor
+
+	const std::size_t capacity_;		//< maximum number of items
+	bool isClosed_;						//< true once close() has been called
+	std::deque<T> items_;				//< queued items
+	std::mutex mutex_;					//< protects items_ and isClosed_
+	std::condition_variable notFull_;	//< signaled when an item is removed or the queue is closed
+	std::condition_variable notEmpty_;	//< signaled when an item is added or the queue is closed
+};
+
+#endif
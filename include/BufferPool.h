@@ -0,0 +1,74 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+/** @class BufferPool
+*   @brief Pool of image buffers keyed by size and type, so that steady-state frame processing reuses the same buffers.
+*   @details acquire() hands out a buffer that nobody else references, allocating one only when all the buffers of that
+*	size and type are in use. A buffer goes back to the pool by itself once every cv::Mat referencing it is released or
+*	reassigned, so there is nothing to give back explicitly. Thread safe.
+*/
+class BufferPool
+{
+public:
+	/// Allocation counters
+	struct Stats
+	{
+		unsigned long nRequests;		///< number of buffers acquired
+		unsigned long nAllocations;		///< number of requests that had to allocate a new buffer
+		std::size_t bytesAllocated;		///< total size of the buffers allocated
+		std::size_t nBuffers;			///< number of buffers held by the pool
+		std::size_t bytesHeld;			///< total size of the buffers held by the pool
+	};
+
+	/// Ctor
+	/// @param[in] maxBuffersPerSize number of buffers of the same size and type the pool keeps. Requests beyond that are
+	/// still served, but their buffers are not kept once released.
+	explicit BufferPool(std::size_t maxBuffersPerSize = 8);
+
+	/// Returns a buffer that is not referenced anywhere else
+	/// @param[in] size image size
+	/// @param[in] type image type, e.g. CV_8UC3
+	/// @return buffer of the requested size and type, with undefined contents
+	cv::Mat acquire(cv::Size size, int type);
+
+	/// @return the allocation counters
+	Stats getStats() const;
+
+	/// Drops the buffers held by the pool. Buffers still in use stay valid.
+	void clear();
+
+private:
+	typedef std::tuple<int, int, int> Key;	//< width, height, type
+
+	/// @return true if buffer is only referenced by the pool
+	static bool isFree(const cv::Mat& buffer);
+
+	std::size_t maxBuffersPerSize_;				//< buffers kept per key
+	std::map<Key, std::vector<cv::Mat> > buffers_;	//< buffers held, by size and type
+	Stats stats_;								//< allocation counters
+	mutable std::mutex mutex_;					//< protects buffers_ and stats_
+};
+
+#endif
@@ -0,0 +1,84 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef DETECTION_ASSOCIATION_H
+#define DETECTION_ASSOCIATION_H
+
+#include <algorithm>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+/** @class RectGrid
+*   @brief Uniform grid spatial index over a set of rectangles.
+*   @details Each rectangle is registered in every cell it covers, so the rectangles that may intersect
+*	a query are found by visiting only the cells the query covers.
+*/
+class RectGrid
+{
+public:
+	/// Ctor, indexes the rectangles
+	/// @param[in] rects rectangles to index. Must outlive the grid.
+	/// @param[in] cellSize side of the square cells in pixels. If 0, uses the mean rectangle size.
+	explicit RectGrid(const std::vector<cv::Rect>& rects, int cellSize = 0);
+
+	/// finds the rectangles whose cells intersect a query rectangle
+	/// @param[in] r query rectangle
+	/// @param[out] candidates indices of the indexed rectangles that may intersect r, sorted and unique
+	void query(const cv::Rect& r, std::vector<int>& candidates) const;
+
+private:
+	/// @return the range of cells covered by r, clipped to the grid
+	cv::Rect cellRange(const cv::Rect& r) const;
+
+	const std::vector<cv::Rect>& rects_;	//< indexed rectangles
+	cv::Point origin_;						//< top left corner of the grid
+	int cellSize_;							//< side of the cells
+	int nCols_, nRows_;						//< grid size, in cells
+	std::vector<std::vector<int>> cells_;	//< indices of the rectangles covering each cell, row major
+};
+
+/// Result of the association of new detections with tracked objects
+struct DetectionAssociation
+{
+	std::vector<int> trackToDetection;	///< for each track, the detection assigned to it, or -1
+	std::vector<int> detectionToTrack;	///< for each detection, the track it was assigned to or duplicates, or -1 if it is a new object
+};
+
+/// Two rectangles overlap if their intersection is greater than half the smaller one
+/// @return true if r1 and r2 overlap
+inline bool overlaps(const cv::Rect& r1, const cv::Rect& r2)
+{
+	return ((r1 & r2).area() > .5 * std::min(r1.area(), r2.area()));
+}
+
+/// @return the intersection over union of two rectangles
+inline double intersectionOverUnion(const cv::Rect& r1, const cv::Rect& r2)
+{
+	const double inter = (r1 & r2).area();
+	const double uni = r1.area() + r2.area() - inter;
+	return (uni > 0 ? inter / uni : 0.);
+}
+
+/// Associates new detections with tracked objects.
+/// Pairs that overlap are assigned one to one, greedily in order of decreasing IoU. Detections that
+/// overlap a track but lose the assignment are duplicates of the track they overlap best.
+/// Candidate pairs are found through a RectGrid over the detections, so the cost is near-linear in the
+/// number of tracks and detections for non-degenerate scenes.
+/// @param[in] tracks locations of the tracked objects
+/// @param[in] detections locations of the new detections
+/// @return the association
+DetectionAssociation associateDetections(const std::vector<cv::Rect>& tracks, const std::vector<cv::Rect>& detections);
+
+#endif
@@ -0,0 +1,141 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef DETECTION_LOG_H
+#define DETECTION_LOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+/*!
+* @file DetectionLog.h
+* Binary, append-only log of detections.
+*
+* A log starts with a header, followed by fixed-size records, one per detection. All values are little endian.
+*
+*     header:  "SFDLOG" | uint16 version | uint32 frame width | uint32 frame height | uint64 config hash
+*              | string input | uint32 number of labels | (int32 label id | string label name) for each label
+*     string:  uint32 length | bytes
+*     record:  uint32 frame | int32 track id | int32 x | int32 y | int32 width | int32 height | float32 score
+*              | int32 label id | uint32 flags
+*/
+
+/// Header of a detection log
+struct DetectionLogHeader
+{
+	std::string input;			///< name of the processed input
+	cv::Size frameSize;			///< size of the processed frames
+	std::uint64_t configHash;	///< hash of the configuration file the detections were obtained with
+	std::vector<std::pair<std::int32_t, std::string>> labels;	///< names of the label ids used in the records
+};
+
+/// A detection, as stored in a log
+struct DetectionRecord
+{
+	std::uint32_t frame;	///< frame number, starting from 1
+	std::int32_t trackId;	///< id of the track of the detection, 0 if untracked
+	cv::Rect roi;			///< location of the detection
+	float score;			///< detection confidence
+	std::int32_t labelId;	///< label of the detection
+	std::uint32_t flags;	///< combination of DetectionRecord::Flags
+	
+	/// Flags qualifying a record
+	enum Flags
+	{
+		NONE = 0,
+		INTERPOLATED = 1,	///< the frame was skipped by the detection, and the record is tracked or interpolated from the detected frames
+	};
+};
+
+/// @return the 64 bit FNV-1a hash of the contents of a file, 0 if it cannot be read
+/// @param[in] fileName name of the file to hash
+std::uint64_t hashFile(const std::string& fileName);
+
+/** @class DetectionLogWriter
+*   @brief Writes a detection log through a large in-memory buffer.
+*/
+class DetectionLogWriter
+{
+public:
+	static const std::size_t DEFAULT_BUFFER_SIZE = 1 << 20;	///< default size of the write buffer, in bytes
+
+	/// Ctor, the writer is not open
+	DetectionLogWriter();
+
+	/// Dtor, flushes the buffered records and closes the file
+	~DetectionLogWriter();
+
+	/// creates a log file and writes its header
+	/// @param[in] fileName name of the file to create
+	/// @param[in] header header of the log
+	/// @param[in] bufferSize size of the write buffer, in bytes
+	/// @throw std::runtime_error if the file cannot be created
+	void open(const std::string& fileName, const DetectionLogHeader& header, std::size_t bufferSize = DEFAULT_BUFFER_SIZE) throw(std::runtime_error);
+
+	/// @return true if the log is open
+	inline bool isOpen() const { return file_.is_open(); }
+
+	/// appends a record. The record is written to disk when the buffer is full, or on flush/close.
+	/// @param[in] record record to append
+	/// @throw std::runtime_error if writing the buffer fails
+	void write(const DetectionRecord& record) throw(std::runtime_error);
+
+	/// writes the buffered records to disk
+	/// @throw std::runtime_error if writing fails
+	void flush() throw(std::runtime_error);
+
+	/// flushes the buffered records and closes the file
+	void close();
+
+private:
+	DetectionLogWriter(const DetectionLogWriter& that) = delete; //disable copy constructor
+
+	std::ofstream file_;			//< log file
+	std::vector<char> buffer_;		//< records not yet written to disk
+	std::size_t bufferSize_;		//< flush threshold
+};
+
+/** @class DetectionLogReader
+*   @brief Reads a detection log sequentially.
+*/
+class DetectionLogReader
+{
+public:
+	/// Ctor, opens a log and reads its header
+	/// @param[in] fileName name of the log
+	/// @throw std::runtime_error if the file cannot be opened or is not a detection log
+	explicit DetectionLogReader(const std::string& fileName) throw(std::runtime_error);
+
+	/// @return the header of the log
+	inline const DetectionLogHeader& header() const { return header_; }
+
+	/// reads the next record
+	/// @param[out] record the record read
+	/// @return false at the end of the log
+	/// @throw std::runtime_error if the log is truncated
+	bool read(DetectionRecord& record) throw(std::runtime_error);
+
+private:
+	std::ifstream file_;			//< log file
+	DetectionLogHeader header_;		//< header of the log
+};
+
+#endif
@@ -40,7 +40,7 @@ public:
 
     void loadFromFile(const std::string& yamlConfigFile, const std::string& classifiersFolder=std::string()) throw(std::runtime_error);
     
-    inline bool isInit() { return init_; }  ///< @return true if parameters are properly initialized.
+    inline bool isInit() const { return init_; }  ///< @return true if parameters are properly initialized.
 
     std::string classifiersFolder;  ///< base directory containing the Adaboost and the SVM classifier
     std::string configFileName;     ///< full path to the configuration file
@@ -61,14 +61,48 @@ public:
     int maxAgePreConfirmation;  ///< max number of frames object can be missed before being confirmed.
     int maxAgePostConfirmation; ///< max number of frames object a confirmed object can be missed without declaring lost.
     int nHangOverFrames;        ///< number of hangover frames during which detection must be confirmed
+    int nTrackingThreads;       ///< number of threads used to update the tracked objects (1: serial, 0: one per hardware thread)
+    bool useMotionPrediction;   ///< whether the tracker search starts from the motion predicted by a constant velocity model
+
+    int reverifyMaxInterval;        ///< a confirmed track is verified by the SVM at least once every this many frames (1: every frame)
+    float reverifyMaxFBError;       ///< verify a confirmed track if the tracker's median forward-backward error exceeds this many pixels
+    float reverifyMinNCC;           ///< verify a confirmed track if the tracker's median NCC falls below this value
+    float reverifyMaxScaleChange;   ///< verify a confirmed track if its scale changes by more than this fraction in one frame
+
+    float frameDeadline;            ///< real-time mode: target processing time per frame in milliseconds (0: no deadline)
+    int maxDegradationLevel;        ///< real-time mode: how far the work per frame may be reduced to meet the deadline (0..4)
+
+    bool quantizeSVM;               ///< whether the SVMs run on int8 descriptors and support vectors
+    float svmQuantizationScale;     ///< descriptor quantization scale, as found by signfinder_calibrate (0: derived from the support vectors)
+
+    int resultCacheSize;            ///< number of views whose detections are remembered, reused when the same view comes back (0: off)
+    int resultCacheMaxDistance;     ///< number of bits of the 256 bits frame hashes that may differ for two frames to be the same view
+    int resultCacheMaxReuse;        ///< number of times cached detections are reused before they are computed again (0: no limit)
+
+    bool incrementalScan;           ///< whether the cascade only rescans the blocks of the frame that changed since the previous scan
+    int incrementalBlockSize;       ///< incremental scan: side of the blocks compared, in pixels of the rescaled frame
+    float incrementalThreshold;     ///< incremental scan: mean absolute gray level difference above which a block has changed
+    int incrementalRefreshInterval; ///< incremental scan: the whole frame is scanned once every this many scans
+
+    bool useRefinement;             ///< whether the boxes of the detections are tightened by a local cascade and SVM search
+    float refinementMargin;         ///< refinement: margin of the searched region around a detection, relative to its size
+    float refinementMinScale;       ///< refinement: smallest refined box, relative to the detection
+    float refinementMaxScale;       ///< refinement: largest refined box, relative to the detection
+    float refinementScaleFactor;    ///< refinement: cascade scale factor within the range
+    float refinementBudget;         ///< refinement: time per frame in milliseconds, after which no refinement is started (0: no limit)
+
+    std::string maskFile;           ///< region mask: image of the scene whose black pixels are never searched (empty: none)
+    std::vector<std::vector<cv::Point2f> > maskPolygons;    ///< region mask: polygons never searched, in coordinates relative to the frame size (0..1)
 	
-	inline bool useThreeStages() { return use3Stages_; }
+	inline bool useThreeStages() const { return use3Stages_; }
+	inline bool hasRegionMask() const { return !maskFile.empty() || !maskPolygons.empty(); }	///< @return true if parts of the frame are never searched
 	std::vector < std::string > labels;
 
 private:
 	bool init_;					///< specifies if the parameters have been initialized or not
 	bool use3Stages_;			///< specifies whether to use an additional verification step 
 	void fixPathString(std::string& instring); ///< fix path strings according to the OS
+	static bool isAbsolutePath(const std::string& path); ///< @return true if path does not depend on the working directory
 	
 	
 	
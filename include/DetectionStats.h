@@ -0,0 +1,120 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef DETECTION_STATS_H
+#define DETECTION_STATS_H
+
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+/** @class LatencyHistogram
+*   @brief Histogram of durations with logarithmic buckets, from which percentiles are estimated.
+*   @details Buckets grow by a factor 2^(1/8) from 1 microsecond, so that percentiles are within about 5% of the exact value
+*	whatever the range of the durations, with a fixed, small memory footprint.
+*/
+class LatencyHistogram
+{
+public:
+	/// Ctor, empty histogram
+	LatencyHistogram();
+
+	/// adds a sample
+	/// @param[in] milliseconds duration
+	void add(double milliseconds);
+
+	/// adds all the samples of another histogram
+	/// @param[in] other histogram to merge
+	void merge(const LatencyHistogram& other);
+
+	/// @return the number of samples
+	inline unsigned long count() const { return count_; }
+
+	/// @return the mean duration in milliseconds, 0 if empty
+	inline double mean() const { return (count_ > 0 ? sum_ / count_ : 0.); }
+
+	/// @return the longest duration in milliseconds, 0 if empty
+	inline double max() const { return max_; }
+
+	/// @return an estimate of a percentile of the durations, in milliseconds, 0 if empty
+	/// @param[in] p percentile, in [0, 100]
+	double percentile(double p) const;
+
+private:
+	std::vector<unsigned long> buckets_;	//< number of samples in each bucket
+	unsigned long count_;					//< number of samples
+	double sum_;							//< sum of the samples (ms)
+	double max_;							//< largest sample (ms)
+};
+
+/** @struct DetectionStats
+*   @brief Per-stage latencies and counters of a detector.
+*/
+struct DetectionStats
+{
+	/// Timed stages of a frame
+	enum Stage
+	{
+		PREPROCESSING = 0,	///< rescaling, cropping and grayscale conversion
+		TRACKING,			///< tracking of the objects of the previous frame, including their SVM re-verification
+		CASCADE,			///< first stage
+		STAGE2,				///< SVM verification of the first stage candidates
+		ASSOCIATION,		///< association of the new detections to the tracked objects, and track bookkeeping
+		REFINEMENT,			///< tightening of the boxes of the detections
+		STAGE3,				///< labelling of the detections
+		TOTAL,				///< whole frame
+		N_STAGES
+	};
+
+	/// @return the name of a stage
+	static const char* stageName(Stage stage);
+
+	DetectionStats();
+
+	/// adds the samples and counters of another detector, for instance to report over several streams
+	/// @param[in] other statistics to merge
+	void merge(const DetectionStats& other);
+
+	/// @return the average number of frames processed per second, over the time spent in detect()
+	inline double fps() const { return (latencies[TOTAL].mean() > 0. ? 1000. / latencies[TOTAL].mean() : 0.); }
+
+	/// prints a latency table (count, mean, p50, p95, p99 and max per stage) followed by the counters
+	/// @param[in] out output stream
+	void print(std::ostream& out) const;
+
+	LatencyHistogram latencies[N_STAGES];	///< latency of each stage, only sampled on the frames where the stage runs
+	unsigned long nFrames;					///< number of processed frames
+	unsigned long nCandidates;				///< number of first stage candidates
+	unsigned long nAccepted;				///< number of candidates accepted by the SVM
+	unsigned long nRejected;				///< number of candidates rejected by the SVM
+	unsigned long nTrackFrames;				///< sum over the frames of the number of active tracks
+	unsigned long maxActiveTracks;			///< largest number of active tracks in a frame
+	unsigned long nCacheHits;				///< number of frames whose detections were found in the result cache
+	unsigned long nCacheMisses;				///< number of frames looked up in the result cache and verified
+	unsigned long nPartialScans;			///< number of frames where the cascade only rescanned the changed blocks
+	unsigned long nBlocks;					///< number of blocks compared by the partial scans
+	unsigned long nDirtyBlocks;				///< number of blocks that changed, and were rescanned, in the partial scans
+	unsigned long nRefined;					///< number of detections whose box was changed by the refinement
+	unsigned long nRefinementsSkipped;		///< number of detections left unrefined because the refinement budget was spent
+};
+
+/// @return the time elapsed since a time point, in milliseconds
+/// @param[in] start time point
+inline double elapsedMilliseconds(const std::chrono::steady_clock::time_point& start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+#endif
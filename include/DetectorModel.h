@@ -0,0 +1,124 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef DETECTOR_MODEL_H
+#define DETECTOR_MODEL_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "DetectionParams.h"
+
+/** @class DetectorModel
+*   @brief Loaded parameters and classifiers of the object detector.
+*   @details A model is immutable once constructed, and all its methods are thread-safe, so a single
+*	model can be shared by the ObjDetector instances processing different streams.
+*	The cascade classifier of OpenCV keeps scratch state while scanning, so the model keeps a small pool of
+*	cascade instances, created from the cascade file loaded once in memory, and lends one to each scan.
+*
+*	If the parameters define a region mask, the cascade skips the windows whose center falls in the masked area, and
+*	drops the candidates centered there. The mask is rendered once per frame size and kept.
+*/
+class DetectorModel
+{
+public:
+	/// Ctor, loads the parameters and the classifiers.
+	/// @param[in] yamlConfigFile config file used to load parameters from
+	/// @param[in] classifiersFolder location of the classifier files (if not available in yamlConfigFile. if classifierFolder is empty, then the locations must be provided in the yamlConfigFile
+	/// @throw runtime_error if there is any problem reading either the config file or the classifier files.
+	DetectorModel(const std::string& yamlConfigFile, const std::string& classifiersFolder = std::string()) throw(std::runtime_error);
+
+	/// Ctor, loads the classifiers named in already parsed parameters.
+	/// @param[in] params parameters, e.g. loaded from a config file and then edited
+	/// @throw runtime_error if there is any problem reading the classifier files.
+	explicit DetectorModel(const DetectionParams& params) throw(std::runtime_error);
+
+	/// Dtor
+	~DetectorModel();
+
+	/// @return the parameters the model was loaded with
+	inline const DetectionParams& params() const { return params_; }
+
+	/// First stage: multi-scale cascade detection with the configured scale factor and window sizes
+	/// @param[in] frame frame to scan
+	/// @return candidate ROIs
+	std::vector<cv::Rect> detectCandidates(const cv::Mat& frame) const;
+
+	/// First stage, overriding the configured scale factor and window sizes
+	/// @param[in] frame frame to scan
+	/// @param[in] scaleFactor scale factor for multiscale detection
+	/// @param[in] minSize minimum window size
+	/// @param[in] maxSize maximum window size
+	/// @param[in] mask if not empty, CV_8UC1 mask of the size of frame: windows centered on its zero pixels are skipped
+	/// @return candidate ROIs
+	std::vector<cv::Rect> detectCandidates(const cv::Mat& frame, float scaleFactor, cv::Size minSize, cv::Size maxSize, const cv::Mat& mask = cv::Mat()) const;
+
+	/// First stage, incremental: only the windows overlapping changed pixels are scanned, and the hits of the previous scan are kept elsewhere
+	/// @param[in] frame frame to scan
+	/// @param[in] scaleFactor scale factor for multiscale detection
+	/// @param[in] minSize minimum window size
+	/// @param[in] maxSize maximum window size
+	/// @param[in] mask if not empty, CV_8UC1 mask of the size of frame: windows centered on its zero pixels are skipped
+	/// @param[in] dirty CV_8UC1 map of the size of frame, nonzero where the frame changed since the previous scan. If empty, the whole frame is scanned.
+	/// @param[in,out] rawHits ungrouped cascade windows of the previous scan, with the same settings. Upon return, those of this frame.
+	/// @return candidate ROIs
+	std::vector<cv::Rect> detectCandidates(const cv::Mat& frame, float scaleFactor, cv::Size minSize, cv::Size maxSize, const cv::Mat& mask, const cv::Mat& dirty, std::vector<cv::Rect>& rawHits) const;
+
+	/// Region mask for frames of a given size, after rescaling and before cropping
+	/// @param[in] frameSize frame size
+	/// @return CV_8UC1 mask of frameSize, zero where the frame is not searched. Empty if the whole frame is searched.
+	/// It is shared, and must not be modified.
+	cv::Mat regionMask(cv::Size frameSize) const;
+
+	/// @param[in] mask region mask, possibly empty
+	/// @param[in] roi region in the coordinates of the mask
+	/// @return true if the center of roi is searched
+	static bool isSearched(const cv::Mat& mask, const cv::Rect& roi);
+
+	/// Second stage: verifies a candidate with the HOG + SVM classifier
+	/// @param[in] patch patch to classify
+	/// @return a pair of values indicating the estimated class and confidence of the patch
+	std::pair<int, double> classify(const cv::Mat& patch) const;
+
+	/// Third stage: labels a verified detection. Only available if params().useThreeStages()
+	/// @param[in] patch patch to classify
+	/// @return a pair of values indicating the estimated class and confidence of the patch
+	std::pair<int, double> classifyStage3(const cv::Mat& patch) const;
+
+	/// Computes the HoG descriptor the second and third stages classify
+	/// @param[in] patch patch to describe
+	/// @return the descriptor
+	std::vector<float> describe(const cv::Mat& patch) const;
+
+private:
+	DetectorModel(const DetectorModel& that) = delete; //disable copy constructor
+
+	class CascadeDetector;	//< first stage detector, LBP + Adaboost cascade
+	class SVMClassifier;	//< second and third stage classifier, HoG + SVM
+
+	DetectionParams params_;							//< loaded parameters
+	std::unique_ptr<CascadeDetector> pCascadeDetector;	//< ptr to first stage detector
+	std::unique_ptr<SVMClassifier> pSVMClassifier;		//< ptr to second stage detector
+	std::unique_ptr<SVMClassifier> pSVMClassifier2;		//< ptr to third stage detector
+	cv::Mat maskImage_;									//< region mask image, as loaded
+	mutable std::map<std::pair<int, int>, cv::Mat> regionMasks_;	//< region masks rendered so far, by frame width and height
+	mutable std::mutex regionMasksMutex_;				//< protects regionMasks_
+};
+
+#endif
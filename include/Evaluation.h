@@ -0,0 +1,200 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef EVALUATION_H
+#define EVALUATION_H
+
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "DetectionParams.h"
+#include "DetectionStats.h"
+
+/** @struct RoiFile
+*   @brief Contents of a ROIs file, as written by SignFinder -r, used both for detections and for annotations.
+*   @details The file starts with the input name, the label and the frame height and width, then lists one ROI per line as
+*	"frame x1 y1 x2 y2 area confidence label", frames counted from 1. Frames without a line have no ROI.
+*/
+struct RoiFile
+{
+	std::string input;                              ///< name of the annotated input
+	std::string label;                              ///< label of the ROIs
+	cv::Size frameSize;                             ///< size of the frames the ROIs are given in
+	std::map<int, std::vector<cv::Rect> > rois;     ///< ROIs, by frame number
+};
+
+/// Reads a ROIs file
+/// @param[in] fileName name of the file
+/// @return the contents of the file
+/// @throw runtime_error if the file cannot be read or is malformed
+RoiFile readRoiFile(const std::string& fileName) throw(std::runtime_error);
+
+/// @return the intersection over union of two rectangles, 0 if either is empty
+double intersectionOverUnion(const cv::Rect& r1, const cv::Rect& r2);
+
+/** @struct MatchCounts
+*   @brief Detections matched against annotations.
+*/
+struct MatchCounts
+{
+	unsigned long nTruePositives;       ///< detections matched to an annotation
+	unsigned long nFalsePositives;      ///< detections not matched
+	unsigned long nFalseNegatives;      ///< annotations not matched
+
+	/// @return the fraction of the detections that are correct, 1 if there is no detection
+	inline double precision() const { return (nTruePositives + nFalsePositives > 0 ? (double)nTruePositives / (nTruePositives + nFalsePositives) : 1.); }
+
+	/// @return the fraction of the annotations that are detected, 1 if there is no annotation
+	inline double recall() const { return (nTruePositives + nFalseNegatives > 0 ? (double)nTruePositives / (nTruePositives + nFalseNegatives) : 1.); }
+
+	/// @return the harmonic mean of precision and recall
+	inline double f1() const { return (precision() + recall() > 0. ? 2. * precision() * recall() / (precision() + recall()) : 0.); }
+
+	/// adds the counts of another frame or clip
+	/// @param[in] other counts to add
+	void add(const MatchCounts& other);
+};
+
+/// Matches the detections of a frame to its annotations, greedily by decreasing overlap, each at most once
+/// @param[in] detections detected ROIs
+/// @param[in] truth annotated ROIs
+/// @param[in] minIoU minimum intersection over union of a match
+/// @return the match counts
+MatchCounts matchDetections(const std::vector<cv::Rect>& detections, const std::vector<cv::Rect>& truth, double minIoU);
+
+/** @struct EvaluationSetting
+*   @brief Detector configuration evaluated on a clip.
+*/
+struct EvaluationSetting
+{
+	std::string name;           ///< short description of the setting
+	DetectionParams params;     ///< parameters of the detector
+	bool doTrack;               ///< whether tracking is on
+	double deadline;            ///< real-time deadline per frame in ms, 0: off, negative: as in params
+};
+
+/** @struct EvaluationResult
+*   @brief Accuracy and speed of a setting on a clip.
+*/
+struct EvaluationResult
+{
+	std::string name;           ///< name of the setting
+	MatchCounts counts;         ///< detections matched against the annotations
+	DetectionStats stats;       ///< per-stage latencies and counters
+};
+
+/** @struct Sweep
+*   @brief Values of the parameters to evaluate. Every combination is evaluated; an empty list keeps the value of the
+*	base parameters.
+*/
+struct Sweep
+{
+	std::vector<int> trackModes;                ///< 1: with tracking, 0: without
+	std::vector<float> cascadeScaleFactors;     ///< cascade scale factors
+	std::vector<float> scalingFactors;          ///< frame rescaling factors
+	std::vector<float> svmThresholds;           ///< SVM thresholds
+	std::vector<float> minWinScales;            ///< factors applied to the minimum and maximum cascade windows
+	std::vector<float> maxWinFactors;           ///< maximum cascade windows, as multiples of the minimum one
+	std::vector<int> quantizeModes;             ///< 1: int8 SVMs, 0: floating point
+	std::vector<double> deadlines;              ///< real-time deadlines in ms (0: off)
+};
+
+/// Parses a comma separated list of values, such as the values of a Sweep given on a command line
+/// @param[in] text list
+/// @return the values
+/// @throw runtime_error if a value cannot be parsed
+template<typename T>
+std::vector<T> parseList(const std::string& text) throw(std::runtime_error)
+{
+	std::vector<T> values;
+	std::istringstream items(text);
+	std::string item;
+	while (std::getline(items, item, ','))
+	{
+		std::istringstream field(item);
+		T value;
+		if (!(field >> value))
+			throw std::runtime_error("Parser Error :: Invalid value " + item + " in list " + text);
+		values.push_back(value);
+	}
+	return values;
+}
+
+/// Lists the settings of a sweep
+/// @param[in] base parameters the sweep starts from
+/// @param[in] sweep values to evaluate
+/// @return one setting per combination of values, named after the values that are swept
+std::vector<EvaluationSetting> makeSettings(const DetectionParams& base, const Sweep& sweep);
+
+/// Decodes a clip ahead of the evaluation, so that decoding is not timed
+/// @param[in] input video file or image sequence
+/// @param[in] maxDim the frames are resized so that their largest dimension is maxDim, as SignFinder -m
+/// @param[in] maxFrames maximum number of frames to decode, 0 for all
+/// @return the frames
+/// @throw runtime_error if the input cannot be opened or has no frame
+std::vector<cv::Mat> loadClip(const std::string& input, int maxDim, int maxFrames = 0) throw(std::runtime_error);
+
+/** @struct Clip
+*   @brief Annotated clip, decoded ahead of the evaluation.
+*/
+struct Clip
+{
+	std::string input;              ///< name of the video
+	std::vector<cv::Mat> frames;    ///< decoded frames, the first one being frame 1 of the annotations
+	RoiFile truth;                  ///< annotations
+};
+
+/// Loads the clips of a list
+/// @param[in] listFileName text file listing one clip per line, as the video name and the name of its ROIs file
+/// separated by blanks. Empty lines and lines starting with '#' are ignored.
+/// @param[in] maxDim the frames are resized so that their largest dimension is maxDim
+/// @param[in] maxFrames maximum number of frames to decode per clip, 0 for all
+/// @return the clips
+/// @throw runtime_error if the list, a video or a ROIs file cannot be read
+std::vector<Clip> loadClips(const std::string& listFileName, int maxDim, int maxFrames = 0) throw(std::runtime_error);
+
+/// Runs a setting over a clip and compares its detections with the annotations.
+/// Settings are independent, so several can be evaluated concurrently on the same frames.
+/// @param[in] setting detector configuration
+/// @param[in] frames frames of the clip, the first one being frame 1 of the annotations
+/// @param[in] truth annotations. The detections are rescaled to its frame size.
+/// @param[in] minIoU minimum intersection over union of a match
+/// @return the accuracy and speed of the setting
+/// @throw runtime_error if the classifiers cannot be loaded
+EvaluationResult evaluate(const EvaluationSetting& setting, const std::vector<cv::Mat>& frames, const RoiFile& truth, double minIoU) throw(std::runtime_error);
+
+/// Runs a setting over several clips, each with a fresh detector, and adds up the results
+/// @param[in] setting detector configuration
+/// @param[in] clips annotated clips
+/// @param[in] minIoU minimum intersection over union of a match
+/// @return the accuracy and speed of the setting over all the clips
+/// @throw runtime_error if the classifiers cannot be loaded
+EvaluationResult evaluate(const EvaluationSetting& setting, const std::vector<Clip>& clips, double minIoU) throw(std::runtime_error);
+
+/// Finds the results that no other result beats in both F1 score and frame rate
+/// @param[in] results evaluation results
+/// @return indices of the Pareto-optimal results, by increasing frame rate
+std::vector<std::size_t> paretoFront(const std::vector<EvaluationResult>& results);
+
+/// Prints results as a table, Pareto-optimal ones marked with '*', followed by the Pareto front
+/// @param[in] out output stream
+/// @param[in] results evaluation results
+void printResults(std::ostream& out, const std::vector<EvaluationResult>& results);
+
+#endif
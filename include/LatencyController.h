@@ -0,0 +1,90 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef LATENCY_CONTROLLER_H
+#define LATENCY_CONTROLLER_H
+
+#include <opencv2/core/core.hpp>
+#include "DetectionParams.h"
+
+/** @class LatencyController
+*   @brief Adapts the first stage work per frame so that frames are processed within a deadline.
+*   @details The controller keeps a smoothed estimate of the frame latency, and moves between degradation levels:
+*	- 0: the configured scale factor and window sizes, the whole frame is scanned
+*	- 1: coarser scale step between pyramid levels
+*	- 2: in addition, the finest pyramid levels are dropped by enlarging the minimum window
+*	- 3: in addition, only the windows around tracked objects are scanned, with a full scan every few frames
+*	- 4: in addition, the cascade is skipped on every other frame, only the tracked objects are updated
+*
+*	It degrades as soon as the smoothed latency exceeds the deadline, and recovers one level at a time after a run of
+*	frames well within the deadline, so that the latency stays steady rather than oscillating.
+*/
+class LatencyController
+{
+public:
+	/// How the first stage runs on a frame
+	struct Plan
+	{
+		bool doScan;				///< whether the cascade runs at all on this frame
+		bool scanTracksOnly;		///< whether only the windows around tracked objects are scanned
+		float scaleFactor;			///< cascade scale factor
+		cv::Size minWin;			///< minimum cascade window
+		cv::Size maxWin;			///< maximum cascade window
+	};
+
+	/// Deadline counters
+	struct Stats
+	{
+		unsigned long nFrames;		///< number of frames processed with a deadline
+		unsigned long nMissed;		///< number of frames that exceeded the deadline
+		int level;					///< current degradation level
+		int maxLevelReached;		///< highest degradation level used so far
+	};
+
+	static const int MAX_LEVEL = 4;	///< highest degradation level
+
+	/// Ctor
+	/// @param[in] deadline target processing time per frame, in milliseconds. 0 disables the controller.
+	/// @param[in] maxLevel highest degradation level the controller may use, at most MAX_LEVEL
+	explicit LatencyController(double deadline = 0., int maxLevel = MAX_LEVEL);
+
+	/// @return true if a deadline is set
+	inline bool isEnabled() const { return deadline_ > 0.; }
+
+	/// @return the deadline, in milliseconds
+	inline double deadline() const { return deadline_; }
+
+	/// @return the deadline counters
+	inline Stats getStats() const { return stats_; }
+
+	/// Plans the first stage of the next frame
+	/// @param[in] params nominal parameters
+	/// @return the scan settings for the next frame
+	Plan plan(const DetectionParams& params) const;
+
+	/// Records the processing time of a frame and adapts the degradation level
+	/// @param[in] latency processing time of the frame, in milliseconds
+	void update(double latency);
+
+private:
+	double deadline_;			//< target latency (ms)
+	int maxLevel_;				//< highest allowed level
+	double smoothedLatency_;	//< exponential moving average of the latency (ms)
+	int nFramesAtLevel_;		//< frames processed since the last level change
+	int nFramesWithinBudget_;	//< consecutive frames well within the deadline
+	Stats stats_;				//< deadline counters
+};
+
+#endif
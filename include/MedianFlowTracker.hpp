@@ -27,6 +27,21 @@
 
 typedef cv::Mat_<std::uint8_t> MatUint8;        ///< grayscale image
 
+/// Goodness of fit of a median flow tracking step
+struct MedianFlowQuality
+{
+    float fbError;      ///< median forward-backward error of the tracked points, in pixels
+    float ncc;          ///< median normalized cross correlation of the points kept after the forward-backward filtering
+    float scale;        ///< estimated scale change of the object between the two frames
+};
+
+/// Expected motion of the object, used to initialize the optical flow search
+struct MedianFlowPrior
+{
+    cv::Point2f motion; ///< predicted displacement of the object since the previous frame, in pixels
+    bool isConfident;   ///< if true, the prediction is trusted and a shallower pyramid and fewer iterations are used
+};
+
 /// Median flow tracker.
 /// Based on http://www3.ee.surrey.ac.uk/CVSSP/Publications/papers/Kalal-ICPR-2010.pdf
 /// @param[in] loc location of the object in the previous frame
@@ -36,4 +51,21 @@ typedef cv::Mat_<std::uint8_t> MatUint8;        ///< grayscale image
 /// TODO: See if we can do away with the whole frame needed in prevImg, and just use the previous patch instead
 cv::Rect trackMedianFlow(const cv::Rect& loc, const MatUint8& prevImg, const MatUint8& currentImg);
 
+/// Median flow tracker, also reporting how well the motion model fits the tracked points.
+/// @param[in] loc location of the object in the previous frame
+/// @param[in] prevImg grayscale representation of the previous frame
+/// @param[in] currentImg grayscale representation of the current frame
+/// @param[out] quality goodness of fit of the estimate. Only meaningful if the object is not lost.
+/// @return estimated location of the object in currentImg. If object is lost, returns cv::Rect()
+cv::Rect trackMedianFlow(const cv::Rect& loc, const MatUint8& prevImg, const MatUint8& currentImg, MedianFlowQuality& quality);
+
+/// Median flow tracker seeded with a motion prediction.
+/// @param[in] loc location of the object in the previous frame
+/// @param[in] prevImg grayscale representation of the previous frame
+/// @param[in] currentImg grayscale representation of the current frame
+/// @param[in] prior predicted motion of the object. The tracked points start the search from their predicted location.
+/// @param[out] quality goodness of fit of the estimate. Only meaningful if the object is not lost.
+/// @return estimated location of the object in currentImg. If object is lost, returns cv::Rect()
+cv::Rect trackMedianFlow(const cv::Rect& loc, const MatUint8& prevImg, const MatUint8& currentImg, const MedianFlowPrior& prior, MedianFlowQuality& quality);
+
 #endif /* MEDIANFLOWTRACKER_HPP_ */
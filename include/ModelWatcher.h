@@ -0,0 +1,87 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef MODEL_WATCHER_H
+#define MODEL_WATCHER_H
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DetectorModel.h"
+
+/** @class ModelWatcher
+*   @brief Reloads a DetectorModel when its configuration or classifier files change.
+*   @details A background thread polls the modification time and size of the configuration file and of the classifier
+*	files it names. When one changes, a new model is loaded on that thread, and handed to a callback that typically passes
+*	it to ObjDetector::setModel(). Detection continues with the previous model while the new one loads, and keeps it if
+*	the new files cannot be loaded.
+*/
+class ModelWatcher
+{
+public:
+	/// Receives the outcome of a reload: the new model, or null and the reason why it could not be loaded
+	typedef std::function<void(std::shared_ptr<const DetectorModel> model, const std::string& error)> Callback;
+
+	/// Ctor, starts watching
+	/// @param[in] yamlConfigFile config file the model is loaded from
+	/// @param[in] classifiersFolder location of the classifier files, as given when loading the model
+	/// @param[in] model model currently in use, loaded from these files
+	/// @param[in] onReload called after each reload attempt, from the thread that made it
+	/// @param[in] periodMs time between two polls of the files, in milliseconds. If 0, the files are not polled, and models are only reloaded by reload().
+	ModelWatcher(const std::string& yamlConfigFile, const std::string& classifiersFolder, std::shared_ptr<const DetectorModel> model, Callback onReload, unsigned int periodMs = 1000);
+
+	/// Dtor, stops watching
+	~ModelWatcher();
+
+	/// reloads the model now, from the calling thread, whether the files changed or not
+	/// @return true if the model was reloaded, false if the previous one is kept
+	bool reload();
+
+	/// @return the last model successfully loaded
+	std::shared_ptr<const DetectorModel> model() const;
+
+private:
+	ModelWatcher(const ModelWatcher& that) = delete; //disable copy constructor
+
+	/// Modification stamp of a file
+	struct FileStamp
+	{
+		std::string fileName;	//< watched file
+		long long mtime;		//< modification time, 0 if the file is missing
+		long long size;			//< size in bytes, -1 if the file is missing
+	};
+
+	std::vector<FileStamp> stampFiles(const DetectionParams& params) const;	///< current stamps of the files of a model
+	void watchLoop();	///< polls the files until stopped
+
+	std::string configFile_;			//< configuration file
+	std::string classifiersFolder_;		//< classifiers folder, if not given by the configuration file
+	Callback onReload_;					//< receives the reloaded models
+	unsigned int periodMs_;				//< polling period
+
+	mutable std::mutex mutex_;			//< protects model_, stamps_ and stop_
+	std::mutex reloadMutex_;			//< serializes the reloads from the watching thread and from reload()
+	std::condition_variable cv_;		//< wakes up the watching thread when stopping
+	std::shared_ptr<const DetectorModel> model_;	//< last loaded model
+	std::vector<FileStamp> stamps_;		//< stamps of the files model_ was loaded from
+	bool stop_;							//< true when the watcher is being destroyed
+	std::thread thread_;				//< watching thread, started last
+};
+
+#endif
@@ -16,18 +16,31 @@ limitations under the License.
 #ifndef OBJ_DETECTOR_H
 #define OBJ_DETECTOR_H
 
-#include <time.h>
+#include <chrono>
 #include <vector>
 #include <string>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <opencv2/core/core.hpp>
+#include "BufferPool.h"
 #include "DetectionParams.h"
+#include "DetectionStats.h"
+#include "DetectorModel.h"
+#include "LatencyController.h"
+#include "ResultCache.h"
+#include "TrackTable.h"
+
+class ThreadPool;
+struct MedianFlowQuality;
 
 /** @class ObjDetector
 *   @brief Two-stages object detector.
 *   @details This class defines a two stage classifier for object detection.
 *	The first stage consists in a multiscale Adaboost Cascade + LBP descriptor to generate candidate ROIs.
 *	The second stage is an SVM trained using HOG desciptor. It confirms or rejects candidate ROIs detected in the first stage.
+*	An ObjDetector holds the state of a single stream (tracked objects, previous frame, counters). The classifiers live in a
+*	DetectorModel, which can be shared by the detectors of many streams.
 */
 class ObjDetector
 {
@@ -39,6 +52,14 @@ public:
         double confidence;      ///< detection confidence as estimated by the SVM
 		int iLabel;				///< label (-1, 1 if 3 stages, 0 otherwise) associated to the ROI
 		std::string sLabel;		///< string associated to the label
+		TrackTable::TrackId trackId;	///< id of the track the detection belongs to, stable across frames. 0 if the detection is not tracked.
+    };
+
+    /// Counters of the SVM re-verifications of tracked objects
+    struct VerificationStats
+    {
+        unsigned long nRun;        ///< number of tracked objects verified by the SVM
+        unsigned long nSkipped;    ///< number of verifications skipped because the tracker fit was reliable
     };
 
     /// Default constructor. The parameters are not initialized.
@@ -49,6 +70,11 @@ public:
     /// @param[in] classifiersFolder location of the classifier files (if not available in yamlConfigFile. if classifierFolder is empty, then the locations must be provided in the yamlConfigFile
     /// @throw runtime_error if there is any problem reading either the config file or the classifier files.
     ObjDetector(const std::string& yamlConfigFile, const std::string& classifiersFolder=std::string()) throw(std::runtime_error);
+
+    /// constructor. The detector uses a model that may be shared with other detectors.
+    /// @param[in] model loaded model
+    /// @throw runtime_error if model is null
+    explicit ObjDetector(std::shared_ptr<const DetectorModel> model) throw(std::runtime_error);
     
     /// Dtor
 	~ObjDetector();
@@ -63,18 +89,44 @@ public:
     
     /// detects SIGNs using the detectors initialized via the vonfiguraion file
     /// @param[in] frame input image
-    /// @param[out[ FPS upon return containst the long-term average frames/second used for profiling
+    /// @param[out[ FPS upon return containst the long-term average frames/second used for profiling, measured with a steady clock
     /// @param[in] doTrack whether to use tracking (default mode). When no tracking is used each frame is considered individually. This is generally less efficient, and may lead to more false alarms.
     /// @return a set of detections
     /// TODO: even if doTrack is false, we can use tracking to see which detections may correspond to which previous detections
     /// @throw std::runtime_error if the classifiers have not been successfully initialized
 	std::vector<DetectionInfo> detect(cv::Mat& frame, double& FPS, bool doTrack=true) throw (std::runtime_error);
+
+    /// queues a frame for detection, and returns without waiting. The cascade of a frame overlaps with the tracking and
+    /// verification of the previous one, and frames are processed in submission order, so the detections are the same as with detect().
+    /// The accessors of the last frame (getStage1Rois(), currFrame...) must not be used while detections are pending.
+    /// @param[in] frame input image. It is not copied, so its pixels must not change until the result is ready.
+    /// @param[in] doTrack whether to use tracking (default mode).
+    /// @return the future detections. Errors during the detection are rethrown when getting the result.
+    /// @throw std::runtime_error if the classifiers have not been successfully initialized
+    std::future<std::vector<DetectionInfo>> detectAsync(const cv::Mat& frame, bool doTrack=true) throw (std::runtime_error);
+
+    /// detects SIGNs in independent images, in parallel and without tracking. The state of the detector is neither used nor
+    /// modified, so this is safe to call from several threads, and concurrently with detect().
+    /// @param[in] images images to process
+    /// @param[in] pool workers sharing the work with the calling thread. If null, the images are processed on the calling thread only.
+    /// @return the detections of each image, in the order of the images, sorted by decreasing confidence
+    /// @throw std::runtime_error if the classifiers have not been successfully initialized
+    std::vector<std::vector<DetectionInfo>> detectBatch(const std::vector<cv::Mat>& images, ThreadPool* pool=nullptr) const throw (std::runtime_error);
     
     /// initializes the parameters using the file in input.
     /// @param[in] yamlConfigFile config file used to load parameters from
     /// @param[in] classifiersFolder location of the classifier files (if not available in yamlConfigFile. if classifierFolder is empty, then the locations must be provided in the yamlConfigFile
     /// @throw runtime_error if there is any problem reading either the config file or the classifier files.
     void init(const std::string& yamlConfigFile, const std::string& classifiersFolder=std::string()) throw (std::runtime_error);
+
+    /// @return the model used by this detector from the next frame on, null if the detector is not initialized
+    inline std::shared_ptr<const DetectorModel> getModel() const { return std::atomic_load(&nextModel_); }
+
+    /// replaces the model without interrupting the stream: the tracked objects are kept, and the frames already being
+    /// processed complete with the previous model. Safe to call from any thread.
+    /// @param[in] model new model, for instance reloaded by a ModelWatcher
+    /// @throw runtime_error if model is null
+    void setModel(std::shared_ptr<const DetectorModel> model) throw(std::runtime_error);
 	
     /// For debugging only
     /// @return the outputs of the first stage (cascade) classifier
@@ -84,6 +136,22 @@ public:
     /// @return the outputs of the second stage (svm) classifier
     std::vector<DetectionInfo> getStage2Rois() const;
     
+    /// @return the number of re-verifications run and skipped since the detector was initialized
+    inline VerificationStats getVerificationStats() const { return verificationStats_; }
+
+    /// @return per-stage latencies and counters since the detector was initialized or the statistics were reset
+    inline const DetectionStats& getStats() const { return stats_; }
+
+    /// clears the per-stage latencies and counters
+    inline void resetStats() { stats_ = DetectionStats(); }
+
+    /// sets the real-time deadline, overriding the one of the configuration. The work per frame is reduced when frames take longer.
+    /// @param[in] deadline target processing time per frame in milliseconds, 0 to always do the full work
+    void setDeadline(double deadline);
+
+    /// @return how often frames exceeded the deadline, and how much the work is currently reduced
+    inline LatencyController::Stats getDeadlineStats() const { std::lock_guard<std::mutex> lock(latencyMutex_); return latencyController_.getStats(); }
+
     /// saves ROIs coming from the first stage to disk
     /// @param[in] prefix prefix of the file names to use when saving first stage results.
 	void dumpStage1(std::string prefix);
@@ -92,45 +160,104 @@ public:
     /// @param[in] prefix prefix of the file names to use hen saving second stage results.G
     void dumpStage2(std::string prefix);
 	
-    cv::Mat currFrame; ///< last processed frame 
+    /// @return the number of bytes of image data copied or resampled into new buffers by the last call to detect()
+    inline std::size_t getBytesCopied() const { return bytesCopied_; }
+
+    /// @return the allocation counters of the pool of rescaled frames. Once the stream is steady, the number of
+    /// allocations stops growing.
+    inline BufferPool::Stats getBufferStats() const { return framePool_.getStats(); }
+
+    cv::Mat currFrame; ///< last processed frame. Shares the pixels of the frame passed to detect(), it is not a copy.
 	std::vector<DetectionInfo> rawRois;        //< raw detections (used for debugging of refinement)
 
 private:
 
 	ObjDetector(const ObjDetector& that) = delete; //disable copy constructor
 
-	void init() throw (std::runtime_error);	///< initializes the classifiers
+	/// Data of a frame handed from the first stage to the second
+	struct FrameState
+	{
+		cv::Mat frame;                      ///< frame after rescaling
+		cv::Mat cropped;                    ///< processed region of frame
+		cv::Mat mask;                       ///< region mask of cropped, empty if the whole region is searched
+		LatencyController::Plan plan;       ///< first stage settings
+		bool hasHash;                       ///< whether the frame was hashed for the result cache
+		ResultCache::Hash hash;             ///< hash of cropped, if hasHash
+		bool isCacheHit;                    ///< true if the verified detections were found in the result cache
+		ResultCache::Result cached;         ///< verified detections found in the result cache
+		std::shared_ptr<const DetectorModel> model;	///< model used for the whole frame
+		std::vector<cv::Rect> candidates;   ///< first stage outputs
+		int nBlocks;                        ///< number of blocks compared by an incremental scan, 0 if the whole frame was scanned
+		int nDirtyBlocks;                   ///< number of blocks that changed, and were scanned again
+		bool hasCandidates;                 ///< false if the cascade is left to the second stage
+		std::size_t bytesCopied;            ///< image data copied by the first stage
+		double preprocessingTime;           ///< time spent rescaling and cropping (ms)
+		double cascadeTime;                 ///< time spent in the cascade (ms)
+		double firstStageTime;              ///< time spent in the first stage (ms)
+	};
 
-	std::vector<DetectionInfo> refineDetections(std::vector<DetectionInfo> rois, float scale);
-	DetectionInfo refineDetection(cv::Rect roi, float scale);
+	/// State of the incremental cascade scan, carried from the first stage of a frame to the next
+	struct ScanHistory
+	{
+		std::shared_ptr<const DetectorModel> model;	///< model of the previous scan, null if there is none
+		LatencyController::Plan plan;       ///< settings of the previous scan
+		cv::Mat reference;                  ///< grayscale cropped frame the hits were found in, updated where blocks changed
+		cv::Mat gray;                       ///< grayscale version of the cropped frame being scanned
+		cv::Mat difference;                 ///< absolute difference of gray and reference
+		cv::Mat blockDifference;            ///< mean absolute difference of each block
+		std::vector<cv::Rect> rawHits;      ///< ungrouped cascade windows of the previous scan
+		int nScans;                         ///< number of scans since the whole frame was last scanned
+	};
 
-	bool init_;
+	void init();	///< resets the stream state
+	void waitForPending();	///< waits for the frames queued by detectAsync()
+	void configureTracking();	///< sets up the tracking workers according to the parameters
+	void adoptModel(std::shared_ptr<const DetectorModel> model);	///< switches the second stage to a new model
+	inline const DetectionParams& params() const { return model_->params(); }	///< parameters of the model
 
-    class CascadeDetector;  //< first stage detector, LBP + Adaboost cascade
-    class SVMClassifier;      //< second stage detector, HoG + SVM
-    std::unique_ptr<CascadeDetector> pCascadeDetector;  //< ptr to first stage detector
-    std::unique_ptr<SVMClassifier> pSVMClassifier;      //< ptr to second stage detector
-	std::unique_ptr<SVMClassifier> pSVMClassifier2;      //< ptr to third stage detector 
+	static DetectionInfo refineDetection(const DetectorModel& model, const cv::Mat& image, const DetectionInfo& detection);	///< tightens the box of a detection
+	static void refineDetections(const DetectorModel& model, const cv::Mat& image, std::vector<DetectionInfo>& detections, ThreadPool* pool, unsigned long& nRefined, unsigned long& nSkipped);	///< refinement stage, within the budget
+	bool needsVerification(std::size_t slot, const MedianFlowQuality& quality) const;	///< re-verification policy for tracked objects
+	void runFirstStage(const cv::Mat& frame, FrameState& state) const;	///< rescaling, cropping and cascade, independent of the stream state
+	std::vector<DetectionInfo> runSecondStage(FrameState& state, bool doTrack);	///< tracking, verification and association
+	void collectCandidates(FrameState& state);	///< moves the first stage outputs to rois_
+	std::vector<DetectionInfo> verifyCandidates(FrameState& state);	///< SVM verification of the candidates, or the cached verdicts of the same view
+	std::vector<cv::Rect> scanCandidates(const DetectorModel& model, const cv::Mat& image, const cv::Mat& mask, const LatencyController::Plan& plan) const;	///< cascade, as planned by the latency controller
+	std::vector<cv::Rect> scanIncrementally(FrameState& state) const;	///< cascade on the blocks that changed since the previous scan
+	static std::vector<DetectionInfo> detectStill(const DetectorModel& model, const cv::Mat& image);	///< stateless detection in a single image
+	static void labelDetections(const DetectorModel& model, const cv::Mat& image, std::vector<DetectionInfo>& detections);	///< third stage
+
+    std::shared_ptr<const DetectorModel> model_;         //< classifiers and parameters of the frame in the second stage, possibly shared with other streams. Only accessed by the second stage, or while no frame is in flight.
+    std::shared_ptr<const DetectorModel> nextModel_;     //< model for the frames to come. Only accessed through std::atomic_load/atomic_store.
+	std::unique_ptr<ThreadPool> pTrackingPool_;          //< workers updating the tracked objects, null if tracking is serial
     
-    DetectionParams params_;
 	cv::Mat cropped_;
+	cv::Mat mask_;          //< region mask of cropped_, empty if the whole frame is searched
     
-    struct TrackingInfo
-    {
-        cv::Rect roi;
-        double confidence;
-        int age;
-        int nTimesSeen;
-    };
-    
-    cv::Mat prevFrame_;
+    cv::Mat prevFrame_;     //< grayscale version of the previous frame, used for tracking
+    cv::Mat grayFrame_;     //< grayscale version of the current frame. Swapped with prevFrame_ so that both buffers are reused.
+    std::size_t bytesCopied_;   //< bytes of image data copied by the last call to detect
+    mutable BufferPool framePool_;  //< buffers of the rescaled frames, recycled once both stages are done with a frame
+    mutable ResultCache resultCache_;   //< verified detections of the views seen recently, looked up by the first stage
+    mutable ScanHistory scanHistory_;   //< previous scan of the incremental cascade, only used by the first stage
+    ResultCache::Hash prevHash_;    //< hash of the previous frame, valid if hasPrevHash_
+    bool hasPrevHash_;              //< whether the previous frame was hashed
     
 	
     std::vector<cv::Rect> rois_;        //< first stage outputs
-    std::vector<TrackingInfo> secondStageOutputs_;  //< second stage outputs, objects that are potentially being tracked
+    TrackTable secondStageOutputs_;     //< second stage outputs, objects that are potentially being tracked
+
+    VerificationStats verificationStats_;   //< re-verification counters
+    LatencyController latencyController_;   //< adapts the first stage to the deadline, if any
+    mutable std::mutex latencyMutex_;       //< protects latencyController_, used by both stages
+    DetectionStats stats_;                  //< per-stage latencies and counters
 
-    time_t start_;
+    std::chrono::steady_clock::time_point start_;   //< start of the first frame, for the long-term frame rate
 	int counter_;
+
+	// declared last, so that the workers finish the queued frames before the rest of the state is destroyed
+	std::unique_ptr<ThreadPool> pFirstStageWorker_;     //< runs the first stage of the frames queued by detectAsync(), null until first used
+	std::unique_ptr<ThreadPool> pSecondStageWorker_;    //< runs the second stage of the frames queued by detectAsync(), in order
 };
 
 #endif
\ No newline at end of file
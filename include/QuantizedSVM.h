@@ -0,0 +1,83 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef QUANTIZED_SVM_H
+#define QUANTIZED_SVM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+struct svm_model;
+
+/** @class QuantizedSVM
+*   @brief Integer evaluation of a binary libsvm model on HOG descriptors.
+*   @details The support vectors and the descriptor are quantized to int8 with a common scale, and the kernel is
+*	evaluated from int32 dot products, using SSE2 or NEON when available. Only the final kernel values, the decision
+*	value and the probability estimate are floating point. The result approximates svm_predict_probability(); how
+*	closely depends on the scale, see signfinder_calibrate.
+*
+*	For a linear kernel, the support vectors are folded into a single weight vector, quantized with its own scale.
+*/
+class QuantizedSVM
+{
+public:
+	/// Ctor, quantizes the support vectors of a model
+	/// @param[in] model libsvm model, not kept
+	/// @param[in] scale descriptor value mapped to 1, i.e. values are quantized to round(value * scale) and saturated to
+	/// [-127, 127]. If not positive, the scale maps the largest support vector value to 127.
+	/// @throw runtime_error if the model is not supported
+	QuantizedSVM(const svm_model* model, float scale) throw(std::runtime_error);
+
+	/// @param[in] model libsvm model
+	/// @return true if the model can be quantized: a binary C-SVC or nu-SVC with probability estimates, and a linear,
+	/// polynomial, RBF or sigmoid kernel
+	static bool supports(const svm_model* model);
+
+	/// @param[in] model libsvm model
+	/// @return the largest absolute value of the support vectors
+	static float maxAbsValue(const svm_model* model);
+
+	/// Predicts the class of a descriptor, as svm_predict_probability()
+	/// @param[in] descriptor HOG descriptor, dense, starting at libsvm index 1
+	/// @param[out] probEstimates probability of each class, in the order of the model labels
+	/// @return the predicted label
+	int predictProbability(const std::vector<float>& descriptor, double probEstimates[2]) const;
+
+	/// @return the quantization scale of the descriptors
+	inline float scale() const { return scale_; }
+
+private:
+	/// @return the decision value of the descriptor
+	double decisionValue(const std::vector<float>& descriptor) const;
+
+	int kernelType_;						//< libsvm kernel type
+	int degree_;							//< polynomial kernel degree
+	double gamma_;							//< kernel gamma
+	double coef0_;							//< kernel coef0
+	double rho_;							//< decision offset
+	double probA_, probB_;					//< Platt scaling of the decision value
+	int labels_[2];							//< model labels
+	float scale_;							//< descriptor quantization scale
+	std::size_t dims_;						//< dimension of the support vectors, padded to a multiple of 16
+	std::size_t nVectors_;					//< number of quantized vectors (1 for a linear kernel)
+	std::vector<std::int8_t> vectors_;		//< quantized support vectors, or weights for a linear kernel, row major
+	std::vector<std::int32_t> sqNorms_;		//< squared norms of the quantized vectors
+	std::vector<double> coefs_;				//< support vector coefficients
+	double weightScale_;					//< linear kernel: quantization scale of the weights
+};
+
+#endif
@@ -0,0 +1,108 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+class DetectorModel;
+
+/** @class ResultCache
+*   @brief Least recently used cache of second stage results, keyed by a perceptual hash of the frame.
+*   @details Looping displays, stalled cameras and duplicated frames show the detector the same view again and again.
+*	The view is summarized by a 256 bits average hash: the frame is reduced to 16x16 gray levels, and each bit tells whether
+*	a cell is brighter than the mean. Frames whose hashes differ by at most a few bits are considered identical, and get the
+*	verified detections of the first one without running the cascade or the SVM. The entries belong to the model they were
+*	computed with, and are dropped when another model stores results. Thread safe.
+*/
+class ResultCache
+{
+public:
+	typedef std::array<std::uint64_t, 4> Hash;	///< average hash of a 16x16 thumbnail, one bit per cell
+
+	/// Verified detections of a frame
+	struct Result
+	{
+		std::vector<cv::Rect> rois;			///< detection locations
+		std::vector<double> confidences;	///< SVM confidences of the detections
+	};
+
+	/// Ctor
+	/// @param[in] capacity number of frames remembered (0: the cache is off)
+	/// @param[in] maxDistance number of bits two hashes may differ by for the frames to be considered identical
+	/// @param[in] maxReuse number of times a result is reused before it is computed again (0: no limit)
+	explicit ResultCache(std::size_t capacity = 0, int maxDistance = 0, int maxReuse = 0);
+
+	/// Changes the settings, and drops the cached results
+	/// @param[in] capacity number of frames remembered (0: the cache is off)
+	/// @param[in] maxDistance number of bits two hashes may differ by for the frames to be considered identical
+	/// @param[in] maxReuse number of times a result is reused before it is computed again (0: no limit)
+	void configure(std::size_t capacity, int maxDistance, int maxReuse);
+
+	/// @return the hash of an image
+	/// @param[in] image grayscale, BGR or BGRA 8 bits image
+	static Hash hashImage(const cv::Mat& image);
+
+	/// @return the number of bits two hashes differ by
+	static int distance(const Hash& hash1, const Hash& hash2);
+
+	/// @return true if two hashes are close enough for their frames to be considered identical
+	bool isSameView(const Hash& hash1, const Hash& hash2) const;
+
+	/// Looks up the result of a frame
+	/// @param[in] model model the result must have been computed with
+	/// @param[in] size size of the frame
+	/// @param[in] hash hash of the frame
+	/// @param[out] result upon return, the cached result if found
+	/// @return true if a result was found. It is then the most recently used.
+	bool find(const std::shared_ptr<const DetectorModel>& model, cv::Size size, const Hash& hash, Result& result);
+
+	/// Stores the result of a frame, evicting the least recently used one if the cache is full
+	/// @param[in] model model the result was computed with. The results of other models are dropped.
+	/// @param[in] size size of the frame
+	/// @param[in] hash hash of the frame
+	/// @param[in] result verified detections
+	void insert(const std::shared_ptr<const DetectorModel>& model, cv::Size size, const Hash& hash, const Result& result);
+
+	/// Drops the cached results
+	void clear();
+
+private:
+	/// Cached result
+	struct Entry
+	{
+		cv::Size size;		//< frame size
+		Hash hash;			//< frame hash
+		Result result;		//< verified detections
+		int nReused;		//< number of times the result was reused
+	};
+
+	std::size_t capacity_;						//< maximum number of entries
+	int maxDistance_;							//< hashes within this many bits are the same view
+	int maxReuse_;								//< reuses before an entry expires (0: never)
+	std::shared_ptr<const DetectorModel> model_;	//< model the entries were computed with
+	std::list<Entry> entries_;					//< most recently used first
+	mutable std::mutex mutex_;					//< protects the entries and the settings
+};
+
+#endif
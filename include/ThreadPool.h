@@ -0,0 +1,82 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/** @class ThreadPool
+*   @brief Fixed-size pool of worker threads.
+*   @details Tasks are executed in submission order by the first available worker.
+*	parallelFor() lets the calling thread take part in the work and only waits for items that are being
+*	processed, so it can safely be called from within a task running on the same pool.
+*/
+class ThreadPool
+{
+public:
+	/// Ctor
+	/// @param[in] nThreads number of worker threads. If 0, uses the number of hardware threads.
+	explicit ThreadPool(unsigned int nThreads);
+
+	/// Dtor. Waits for the queued tasks to complete before joining the workers.
+	~ThreadPool();
+
+	/// @return the number of worker threads
+	inline std::size_t size() const { return workers_.size(); }
+
+	/// queues a task for execution
+	/// @param[in] f callable taking no arguments
+	/// @return a future holding the result of f, or the exception it threw
+	template<typename F>
+	std::future<typename std::result_of<F()>::type> submit(F f)
+	{
+		typedef typename std::result_of<F()>::type R;
+		auto pTask = std::make_shared<std::packaged_task<R()>>(std::move(f));
+		std::future<R> res = pTask->get_future();
+		enqueue([pTask](){ (*pTask)(); });
+		return res;
+	}
+
+	/// calls fn(i) for every i in [0, n), distributing the calls over the workers and the calling thread.
+	/// Returns when all calls have completed. Calls may run in any order.
+	/// @param[in] n number of items
+	/// @param[in] fn function to call for each item
+	/// @throw the first exception thrown by fn, after all other calls have completed
+	void parallelFor(std::size_t n, const std::function<void(std::size_t)>& fn);
+
+private:
+	ThreadPool(const ThreadPool& that) = delete; //disable copy constructor
+
+	void enqueue(std::function<void()> task);	///< adds a task to the queue and wakes up a worker
+	void workerLoop();							///< main loop of each worker
+
+	std::vector<std::thread> workers_;			//< worker threads
+	std::deque<std::function<void()>> tasks_;	//< queued tasks
+	std::mutex mutex_;							//< protects tasks_ and stop_
+	std::condition_variable cv_;				//< signals new tasks or stop
+	bool stop_;									//< true when the pool is being destroyed
+};
+
+#endif
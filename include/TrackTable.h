@@ -0,0 +1,72 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef TRACK_TABLE_H
+#define TRACK_TABLE_H
+
+#include <cstddef>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+/** @class TrackTable
+*   @brief Table of the objects currently tracked by ObjDetector.
+*   @details The fields of each track are stored in parallel arrays (structure of arrays) indexed by slot.
+*	Removing a track moves the last slot into the freed one, so pruning is constant time but does not
+*	preserve the slot order. Use the track id, which never changes, to follow an object across frames.
+*/
+class TrackTable
+{
+public:
+	typedef int TrackId;	///< track identifier. Ids are assigned in increasing order starting from 1, 0 is never used.
+
+	/// Ctor, creates an empty table
+	TrackTable();
+
+	/// Dtor
+	~TrackTable();
+
+	inline std::size_t size() const { return ids.size(); }	///< @return the number of tracks in the table
+	inline bool empty() const { return ids.empty(); }		///< @return true if no object is being tracked
+
+	/// adds a new track at the end of the table
+	/// @param[in] roi location of the object
+	/// @param[in] confidence detection confidence
+	/// @param[in] age number of frames since the object was last confirmed
+	/// @param[in] nTimesSeen number of frames the object has been confirmed in
+	/// @return the id assigned to the new track
+	TrackId add(const cv::Rect& roi, double confidence, int age = 0, int nTimesSeen = 1);
+
+	/// removes a track, replacing it with the track in the last slot
+	/// @param[in] slot slot of the track to remove
+	void remove(std::size_t slot);
+
+	/// removes all tracks. Ids of tracks added later will not collide with previously assigned ones.
+	void clear();
+
+	std::vector<TrackId> ids;			///< stable id of each track
+	std::vector<cv::Rect> rois;			///< location of each tracked object
+	std::vector<double> confidences;	///< last confidence estimated by the SVM
+	std::vector<int> ages;				///< number of frames since the object was last confirmed
+	std::vector<int> nTimesSeen;		///< number of frames the object has been confirmed in
+	std::vector<int> nFramesSinceVerification;	///< number of frames since the object was last verified by the SVM
+	std::vector<cv::Point2f> velocities;		///< smoothed motion of the object center, in pixels/frame
+	std::vector<float> motionResiduals;			///< distance between the predicted and the measured motion in the last tracked frame
+	std::vector<int> nMotionSamples;			///< number of tracked frames the velocity has been estimated from
+
+private:
+	TrackId nextId_;	///< id assigned to the next track
+};
+
+#endif
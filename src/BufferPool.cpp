@@ -0,0 +1,68 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "BufferPool.h"
+
+BufferPool::BufferPool(std::size_t maxBuffersPerSize) :
+maxBuffersPerSize_(maxBuffersPerSize),
+stats_({ 0, 0, 0, 0, 0 })
+{
+}
+
+bool BufferPool::isFree(const cv::Mat& buffer)
+{
+#if CV_MAJOR_VERSION < 3
+	return (buffer.refcount != nullptr) && (*buffer.refcount == 1);
+#else
+	return (buffer.u != nullptr) && (buffer.u->refcount == 1);
+#endif
+}
+
+cv::Mat BufferPool::acquire(cv::Size size, int type)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	++stats_.nRequests;
+	auto& buffers = buffers_[Key(size.width, size.height, type)];
+	for (const auto& buffer : buffers)
+	{
+		if (isFree(buffer))
+			return buffer;	//shares the buffer, which is in use until the returned header and its copies are released
+	}
+	cv::Mat buffer(size, type);
+	const std::size_t bytes = buffer.total() * buffer.elemSize();
+	++stats_.nAllocations;
+	stats_.bytesAllocated += bytes;
+	if (buffers.size() < maxBuffersPerSize_)
+	{
+		buffers.push_back(buffer);
+		++stats_.nBuffers;
+		stats_.bytesHeld += bytes;
+	}
+	return buffer;
+}
+
+BufferPool::Stats BufferPool::getStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return stats_;
+}
+
+void BufferPool::clear()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	buffers_.clear();
+	stats_.nBuffers = 0;
+	stats_.bytesHeld = 0;
+}
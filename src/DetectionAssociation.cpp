@@ -0,0 +1,152 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "DetectionAssociation.h"
+#include <algorithm>
+#include <tuple>
+
+//===========================
+//
+// RECTGRID
+//
+//===========================
+
+RectGrid::RectGrid(const std::vector<cv::Rect>& rects, int cellSize) :
+rects_(rects),
+cellSize_(cellSize),
+nCols_(0),
+nRows_(0)
+{
+	if (rects_.empty())
+		return;
+
+	cv::Rect bounds = rects_.front();
+	long sumSize = 0;
+	for (const auto& r : rects_)
+	{
+		bounds |= r;
+		sumSize += std::max(r.width, r.height);
+	}
+	if (cellSize_ <= 0)
+	{
+		cellSize_ = std::max(8, (int)(sumSize / (long)rects_.size()));
+	}
+	origin_ = bounds.tl();
+	nCols_ = bounds.width / cellSize_ + 1;
+	nRows_ = bounds.height / cellSize_ + 1;
+	cells_.resize(nCols_ * nRows_);
+
+	for (int i = 0; i < (int)rects_.size(); ++i)
+	{
+		const cv::Rect range = cellRange(rects_[i]);
+		for (int row = range.y; row < range.y + range.height; ++row)
+		{
+			for (int col = range.x; col < range.x + range.width; ++col)
+			{
+				cells_[row * nCols_ + col].push_back(i);
+			}
+		}
+	}
+}
+
+cv::Rect RectGrid::cellRange(const cv::Rect& r) const
+{
+	const int col0 = std::max(0, (r.x - origin_.x) / cellSize_);
+	const int row0 = std::max(0, (r.y - origin_.y) / cellSize_);
+	const int col1 = std::min(nCols_ - 1, (r.x + r.width - 1 - origin_.x) / cellSize_);
+	const int row1 = std::min(nRows_ - 1, (r.y + r.height - 1 - origin_.y) / cellSize_);
+	if ((r.x + r.width <= origin_.x) || (r.y + r.height <= origin_.y) || (col0 > col1) || (row0 > row1))
+		return cv::Rect();
+	return cv::Rect(col0, row0, col1 - col0 + 1, row1 - row0 + 1);
+}
+
+void RectGrid::query(const cv::Rect& r, std::vector<int>& candidates) const
+{
+	candidates.clear();
+	if (cells_.empty() || (r.area() <= 0))
+		return;
+	const cv::Rect range = cellRange(r);
+	for (int row = range.y; row < range.y + range.height; ++row)
+	{
+		for (int col = range.x; col < range.x + range.width; ++col)
+		{
+			const auto& cell = cells_[row * nCols_ + col];
+			candidates.insert(candidates.end(), cell.begin(), cell.end());
+		}
+	}
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+}
+
+//===========================
+//
+// ASSOCIATION
+//
+//===========================
+
+DetectionAssociation associateDetections(const std::vector<cv::Rect>& tracks, const std::vector<cv::Rect>& detections)
+{
+	DetectionAssociation association;
+	association.trackToDetection.assign(tracks.size(), -1);
+	association.detectionToTrack.assign(detections.size(), -1);
+	if (tracks.empty() || detections.empty())
+		return association;
+
+	// gather overlapping pairs through the grid
+	struct Candidate
+	{
+		double iou;
+		int track;
+		int detection;
+	};
+	std::vector<Candidate> pairs;
+	const RectGrid grid(detections);
+	std::vector<int> nearby;
+	for (int i = 0; i < (int)tracks.size(); ++i)
+	{
+		grid.query(tracks[i], nearby);
+		for (int j : nearby)
+		{
+			if (overlaps(tracks[i], detections[j]))
+			{
+				pairs.push_back({ intersectionOverUnion(tracks[i], detections[j]), i, j });
+			}
+		}
+	}
+
+	// greedy one to one assignment by decreasing IoU, ties broken by index so the result is deterministic
+	std::sort(pairs.begin(), pairs.end(), [](const Candidate& c1, const Candidate& c2)
+	{
+		return std::make_tuple(-c1.iou, c1.track, c1.detection) < std::make_tuple(-c2.iou, c2.track, c2.detection);
+	});
+	for (const auto& c : pairs)
+	{
+		if ((association.trackToDetection[c.track] < 0) && (association.detectionToTrack[c.detection] < 0))
+		{
+			association.trackToDetection[c.track] = c.detection;
+			association.detectionToTrack[c.detection] = c.track;
+		}
+	}
+
+	// detections left over that overlap a track are duplicates of their best overlapping track
+	for (const auto& c : pairs)
+	{
+		if (association.detectionToTrack[c.detection] < 0)
+		{
+			association.detectionToTrack[c.detection] = c.track;
+		}
+	}
+	return association;
+}
@@ -0,0 +1,255 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "DetectionLog.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace
+{
+	static const char MAGIC[6] = { 'S', 'F', 'D', 'L', 'O', 'G' };
+	static const std::uint16_t VERSION = 1;
+	static const std::size_t RECORD_SIZE = 9 * 4;	//< size of a record on disk, in bytes
+
+	//=========================
+	//
+	// ENCODING
+	//
+	//=========================
+
+	inline void put16(std::vector<char>& out, std::uint16_t v)
+	{
+		out.push_back((char)(v & 0xff));
+		out.push_back((char)(v >> 8));
+	}
+
+	inline void put32(std::vector<char>& out, std::uint32_t v)
+	{
+		for (int b = 0; b < 4; ++b)
+			out.push_back((char)((v >> (8 * b)) & 0xff));
+	}
+
+	inline void put64(std::vector<char>& out, std::uint64_t v)
+	{
+		for (int b = 0; b < 8; ++b)
+			out.push_back((char)((v >> (8 * b)) & 0xff));
+	}
+
+	inline void putFloat(std::vector<char>& out, float v)
+	{
+		std::uint32_t bits;
+		std::memcpy(&bits, &v, sizeof(bits));
+		put32(out, bits);
+	}
+
+	inline void putString(std::vector<char>& out, const std::string& s)
+	{
+		put32(out, (std::uint32_t)s.size());
+		out.insert(out.end(), s.begin(), s.end());
+	}
+
+	//=========================
+	//
+	// DECODING
+	//
+	//=========================
+
+	/// reads exactly n bytes
+	/// @return false if the end of the file was reached before reading any byte
+	/// @throw std::runtime_error if the file ends after a partial read
+	bool readBytes(std::ifstream& in, char* data, std::size_t n)
+	{
+		in.read(data, n);
+		const std::size_t nRead = (std::size_t)in.gcount();
+		if (nRead == n)
+			return true;
+		if (nRead == 0)
+			return false;
+		throw std::runtime_error("DETECTION LOG ERROR :: Truncated file");
+	}
+
+	void readRequired(std::ifstream& in, char* data, std::size_t n)
+	{
+		if (!readBytes(in, data, n))
+			throw std::runtime_error("DETECTION LOG ERROR :: Truncated file");
+	}
+
+	inline std::uint32_t get32(const unsigned char* p)
+	{
+		return (std::uint32_t)p[0] | ((std::uint32_t)p[1] << 8) | ((std::uint32_t)p[2] << 16) | ((std::uint32_t)p[3] << 24);
+	}
+
+	std::uint32_t read32(std::ifstream& in)
+	{
+		unsigned char b[4];
+		readRequired(in, (char*)b, 4);
+		return get32(b);
+	}
+
+	std::string readString(std::ifstream& in)
+	{
+		const std::uint32_t size = read32(in);
+		std::string s(size, '\0');
+		if (size > 0)
+			readRequired(in, &s[0], size);
+		return s;
+	}
+}   //::<anon>
+
+std::uint64_t hashFile(const std::string& fileName)
+{
+	std::ifstream file(fileName, std::ios::in | std::ios::binary);
+	if (!file.is_open())
+		return 0;
+	std::uint64_t hash = 14695981039346656037ull;	//FNV offset basis
+	char buffer[4096];
+	while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+	{
+		for (std::streamsize i = 0; i < file.gcount(); ++i)
+		{
+			hash ^= (unsigned char)buffer[i];
+			hash *= 1099511628211ull;	//FNV prime
+		}
+	}
+	return hash;
+}
+
+//===========================
+//
+// DETECTIONLOGWRITER
+//
+//===========================
+
+DetectionLogWriter::DetectionLogWriter() :
+bufferSize_(DEFAULT_BUFFER_SIZE)
+{
+}
+
+DetectionLogWriter::~DetectionLogWriter()
+{
+	close();
+}
+
+void DetectionLogWriter::open(const std::string& fileName, const DetectionLogHeader& header, std::size_t bufferSize) throw(std::runtime_error)
+{
+	close();
+	file_.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file_.is_open())
+		throw std::runtime_error("DETECTION LOG ERROR :: Unable to create " + fileName);
+	bufferSize_ = std::max(bufferSize, RECORD_SIZE);
+	buffer_.clear();
+	buffer_.reserve(bufferSize_ + RECORD_SIZE);
+
+	buffer_.insert(buffer_.end(), MAGIC, MAGIC + sizeof(MAGIC));
+	put16(buffer_, VERSION);
+	put32(buffer_, (std::uint32_t)header.frameSize.width);
+	put32(buffer_, (std::uint32_t)header.frameSize.height);
+	put64(buffer_, header.configHash);
+	putString(buffer_, header.input);
+	put32(buffer_, (std::uint32_t)header.labels.size());
+	for (const auto& label : header.labels)
+	{
+		put32(buffer_, (std::uint32_t)label.first);
+		putString(buffer_, label.second);
+	}
+	flush();
+}
+
+void DetectionLogWriter::write(const DetectionRecord& record) throw(std::runtime_error)
+{
+	assert(isOpen());
+	put32(buffer_, record.frame);
+	put32(buffer_, (std::uint32_t)record.trackId);
+	put32(buffer_, (std::uint32_t)record.roi.x);
+	put32(buffer_, (std::uint32_t)record.roi.y);
+	put32(buffer_, (std::uint32_t)record.roi.width);
+	put32(buffer_, (std::uint32_t)record.roi.height);
+	putFloat(buffer_, record.score);
+	put32(buffer_, (std::uint32_t)record.labelId);
+	put32(buffer_, record.flags);
+	if (buffer_.size() >= bufferSize_)
+		flush();
+}
+
+void DetectionLogWriter::flush() throw(std::runtime_error)
+{
+	if (!buffer_.empty())
+	{
+		file_.write(buffer_.data(), buffer_.size());
+		buffer_.clear();
+	}
+	file_.flush();
+	if (!file_)
+		throw std::runtime_error("DETECTION LOG ERROR :: Write failed");
+}
+
+void DetectionLogWriter::close()
+{
+	if (!file_.is_open())
+		return;
+	if (!buffer_.empty())
+		file_.write(buffer_.data(), buffer_.size());
+	buffer_.clear();
+	file_.close();
+}
+
+//===========================
+//
+// DETECTIONLOGREADER
+//
+//===========================
+
+DetectionLogReader::DetectionLogReader(const std::string& fileName) throw(std::runtime_error) :
+file_(fileName, std::ios::in | std::ios::binary)
+{
+	if (!file_.is_open())
+		throw std::runtime_error("DETECTION LOG ERROR :: Unable to open " + fileName);
+	char magic[sizeof(MAGIC)];
+	unsigned char version[2];
+	if (!readBytes(file_, magic, sizeof(magic)) || (0 != std::memcmp(magic, MAGIC, sizeof(MAGIC))))
+		throw std::runtime_error("DETECTION LOG ERROR :: Not a detection log: " + fileName);
+	readRequired(file_, (char*)version, sizeof(version));
+	if ((version[0] | (version[1] << 8)) != VERSION)
+		throw std::runtime_error("DETECTION LOG ERROR :: Unsupported version in " + fileName);
+
+	header_.frameSize.width = (int)read32(file_);
+	header_.frameSize.height = (int)read32(file_);
+	const std::uint64_t hashLow = read32(file_);
+	const std::uint64_t hashHigh = read32(file_);
+	header_.configHash = hashLow | (hashHigh << 32);
+	header_.input = readString(file_);
+	const std::uint32_t nLabels = read32(file_);
+	for (std::uint32_t i = 0; i < nLabels; ++i)
+	{
+		const std::int32_t id = (std::int32_t)read32(file_);
+		header_.labels.push_back(std::make_pair(id, readString(file_)));
+	}
+}
+
+bool DetectionLogReader::read(DetectionRecord& record) throw(std::runtime_error)
+{
+	unsigned char b[RECORD_SIZE];
+	if (!readBytes(file_, (char*)b, RECORD_SIZE))
+		return false;
+	record.frame = get32(b);
+	record.trackId = (std::int32_t)get32(b + 4);
+	record.roi = cv::Rect((std::int32_t)get32(b + 8), (std::int32_t)get32(b + 12), (std::int32_t)get32(b + 16), (std::int32_t)get32(b + 20));
+	const std::uint32_t bits = get32(b + 24);
+	std::memcpy(&record.score, &bits, sizeof(bits));
+	record.labelId = (std::int32_t)get32(b + 28);
+	record.flags = get32(b + 32);
+	return true;
+}
@@ -179,16 +179,219 @@ void DetectionParams::loadFromFile(const std::string& yamlConfigFile, const std:
 		n = fs["nHangOverFrames"];
 		nHangOverFrames = (n.empty() ? 3 : (int)n);
 
+		n = fs["nTrackingThreads"];
+		nTrackingThreads = (n.empty() ? 1 : (int)n);
+
+		n = fs["useMotionPrediction"];
+		useMotionPrediction = (n.empty() ? true : (int)n != 0);
+
+		n = fs["Reverification"];
+		if (n.empty())
+		{
+			reverifyMaxInterval = 1;
+			reverifyMaxFBError = 1.f;
+			reverifyMinNCC = .8f;
+			reverifyMaxScaleChange = .05f;
+		}
+		else
+		{
+			n2 = n["maxInterval"];
+			reverifyMaxInterval = (n2.empty() ? 1 : (int)n2);
+			if (reverifyMaxInterval < 1)
+				throw std::runtime_error("Parser Error :: Reverification maxInterval must be at least 1.\n");
+
+			n2 = n["maxFBError"];
+			reverifyMaxFBError = (n2.empty() ? 1.f : (float)n2);
+
+			n2 = n["minNCC"];
+			reverifyMinNCC = (n2.empty() ? .8f : (float)n2);
+
+			n2 = n["maxScaleChange"];
+			reverifyMaxScaleChange = (n2.empty() ? .05f : (float)n2);
+		}
+
+		n = fs["RealTime"];
+		if (n.empty())
+		{
+			frameDeadline = 0.f;
+			maxDegradationLevel = 4;
+		}
+		else
+		{
+			n2 = n["deadline"];
+			frameDeadline = (n2.empty() ? 0.f : (float)n2);
+			if (frameDeadline < 0.f)
+				throw std::runtime_error("Parser Error :: RealTime deadline must not be negative.\n");
+
+			n2 = n["maxLevel"];
+			maxDegradationLevel = (n2.empty() ? 4 : (int)n2);
+			if ((maxDegradationLevel < 0) || (maxDegradationLevel > 4))
+				throw std::runtime_error("Parser Error :: RealTime maxLevel must be between 0 and 4.\n");
+		}
+
+		n = fs["Quantization"];
+		if (n.empty())
+		{
+			quantizeSVM = false;
+			svmQuantizationScale = 0.f;
+		}
+		else
+		{
+			n2 = n["enabled"];
+			quantizeSVM = (n2.empty() ? false : (int)n2 != 0);
+
+			n2 = n["scale"];
+			svmQuantizationScale = (n2.empty() ? 0.f : (float)n2);
+			if (svmQuantizationScale < 0.f)
+				throw std::runtime_error("Parser Error :: Quantization scale must not be negative.\n");
+		}
+
+		n = fs["ResultCache"];
+		if (n.empty())
+		{
+			resultCacheSize = 0;
+			resultCacheMaxDistance = 0;
+			resultCacheMaxReuse = 0;
+		}
+		else
+		{
+			n2 = n["size"];
+			resultCacheSize = (n2.empty() ? 0 : (int)n2);
+			if (resultCacheSize < 0)
+				throw std::runtime_error("Parser Error :: ResultCache size must not be negative.\n");
+
+			n2 = n["maxDistance"];
+			resultCacheMaxDistance = (n2.empty() ? 0 : (int)n2);
+			if ((resultCacheMaxDistance < 0) || (resultCacheMaxDistance > 256))
+				throw std::runtime_error("Parser Error :: ResultCache maxDistance must be between 0 and 256.\n");
+
+			n2 = n["maxReuse"];
+			resultCacheMaxReuse = (n2.empty() ? 0 : (int)n2);
+			if (resultCacheMaxReuse < 0)
+				throw std::runtime_error("Parser Error :: ResultCache maxReuse must not be negative.\n");
+		}
+
+		n = fs["IncrementalScan"];
+		if (n.empty())
+		{
+			incrementalScan = false;
+			incrementalBlockSize = 16;
+			incrementalThreshold = 8.f;
+			incrementalRefreshInterval = 30;
+		}
+		else
+		{
+			n2 = n["enabled"];
+			incrementalScan = (n2.empty() ? false : (int)n2 != 0);
+
+			n2 = n["blockSize"];
+			incrementalBlockSize = (n2.empty() ? 16 : (int)n2);
+			if (incrementalBlockSize < 1)
+				throw std::runtime_error("Parser Error :: IncrementalScan blockSize must be at least 1.\n");
+
+			n2 = n["threshold"];
+			incrementalThreshold = (n2.empty() ? 8.f : (float)n2);
+			if (incrementalThreshold < 0.f)
+				throw std::runtime_error("Parser Error :: IncrementalScan threshold must not be negative.\n");
+
+			n2 = n["refreshInterval"];
+			incrementalRefreshInterval = (n2.empty() ? 30 : (int)n2);
+			if (incrementalRefreshInterval < 1)
+				throw std::runtime_error("Parser Error :: IncrementalScan refreshInterval must be at least 1.\n");
+		}
+
+		n = fs["Refinement"];
+		if (n.empty())
+		{
+			useRefinement = false;
+			refinementMargin = .25f;
+			refinementMinScale = .8f;
+			refinementMaxScale = 1.25f;
+			refinementScaleFactor = 1.05f;
+			refinementBudget = 0.f;
+		}
+		else
+		{
+			n2 = n["enabled"];
+			useRefinement = (n2.empty() ? false : (int)n2 != 0);
+
+			n2 = n["margin"];
+			refinementMargin = (n2.empty() ? .25f : (float)n2);
+			if (refinementMargin < 0.f)
+				throw std::runtime_error("Parser Error :: Refinement margin must not be negative.\n");
+
+			n2 = n["minScale"];
+			refinementMinScale = (n2.empty() ? .8f : (float)n2);
+			n2 = n["maxScale"];
+			refinementMaxScale = (n2.empty() ? 1.25f : (float)n2);
+			if ((refinementMinScale <= 0.f) || (refinementMaxScale < refinementMinScale))
+				throw std::runtime_error("Parser Error :: Refinement scales must satisfy 0 < minScale <= maxScale.\n");
+
+			n2 = n["scaleFactor"];
+			refinementScaleFactor = (n2.empty() ? 1.05f : (float)n2);
+			if (refinementScaleFactor <= 1.f)
+				throw std::runtime_error("Parser Error :: Refinement scaleFactor must be greater than 1.\n");
+
+			n2 = n["budget"];
+			refinementBudget = (n2.empty() ? 0.f : (float)n2);
+			if (refinementBudget < 0.f)
+				throw std::runtime_error("Parser Error :: Refinement budget must not be negative.\n");
+		}
+
+		maskFile.clear();
+		maskPolygons.clear();
+		n = fs["RegionMask"];
+		if (!n.empty())
+		{
+			n2 = n["file"];
+			maskFile = (n2.empty() ? std::string() : (std::string)n2);
+			if (!maskFile.empty() && !isAbsolutePath(maskFile))
+			{
+				//relative to the configuration file, which is specific to the camera, unlike the classifiers
+				const std::size_t sep = configFileName.find_last_of("/\\");
+				maskFile = (sep == std::string::npos ? std::string() : configFileName.substr(0, sep + 1)) + maskFile;
+			}
+
+			n2 = n["ignore"];
+			for (auto it = n2.begin(); it != n2.end(); ++it)
+			{
+				const cv::FileNode polygon = *it;
+				if (!polygon.isSeq() || (polygon.size() < 6) || (polygon.size() % 2 != 0))
+					throw std::runtime_error("Parser Error :: RegionMask ignore polygons must list at least 3 x, y pairs.\n");
+				std::vector<cv::Point2f> points;
+				for (int i = 0; i < (int)polygon.size(); i += 2)
+				{
+					points.push_back(cv::Point2f((float)polygon[i], (float)polygon[i + 1]));
+				}
+				maskPolygons.push_back(points);
+			}
+		}
+
 		init_ = true;
 	}
 
+	catch (std::runtime_error&)
+	{
+		throw;
+	}
 	catch (std::exception& e)
 	{
-		throw(e);
+		//cv::Exception from FileStorage, e.g. on a half-written file
+		throw std::runtime_error(std::string("CONFIG PARSER ERROR :: ") + e.what() + "\n");
 	}
 
 }
 
+bool DetectionParams::isAbsolutePath(const std::string& path){
+	if (path.empty())
+		return false;
+#ifdef _WIN32
+	return (path[0] == '\\') || (path[0] == '/') || ((path.size() > 1) && (path[1] == ':'));
+#else
+	return (path[0] == '/');
+#endif
+}
+
 void DetectionParams::fixPathString(std::string& instring){
 
 	char  sep = separator();
@@ -0,0 +1,165 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "DetectionStats.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+namespace
+{
+	static const int BUCKETS_PER_OCTAVE = 8;	//< resolution of the histogram
+	static const int N_OCTAVES = 28;			//< range of the histogram, 1us to about 4.5 min
+	static const int N_BUCKETS = BUCKETS_PER_OCTAVE * N_OCTAVES + 1;
+
+	/// @return the bucket of a duration
+	inline int bucketOf(double milliseconds)
+	{
+		const double us = milliseconds * 1000.;
+		if (us <= 1.)
+			return 0;
+		return std::min(N_BUCKETS - 1, 1 + (int)(BUCKETS_PER_OCTAVE * std::log2(us)));
+	}
+
+	/// @return a representative duration of a bucket, in milliseconds: the geometric center of its range
+	inline double bucketValue(int bucket)
+	{
+		if (0 == bucket)
+			return .001;
+		return std::exp2((bucket - .5) / BUCKETS_PER_OCTAVE) / 1000.;
+	}
+}   //::<anon>
+
+//===========================
+//
+// LATENCYHISTOGRAM
+//
+//===========================
+
+LatencyHistogram::LatencyHistogram() :
+buckets_(N_BUCKETS, 0),
+count_(0),
+sum_(0.),
+max_(0.)
+{
+}
+
+void LatencyHistogram::add(double milliseconds)
+{
+	++buckets_[bucketOf(milliseconds)];
+	++count_;
+	sum_ += milliseconds;
+	max_ = std::max(max_, milliseconds);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+	for (int i = 0; i < N_BUCKETS; ++i)
+		buckets_[i] += other.buckets_[i];
+	count_ += other.count_;
+	sum_ += other.sum_;
+	max_ = std::max(max_, other.max_);
+}
+
+double LatencyHistogram::percentile(double p) const
+{
+	if (0 == count_)
+		return 0.;
+	const double rank = std::max(1., std::ceil(p / 100. * count_));	//rank of the sample, starting from 1
+	unsigned long nBelow = 0;
+	for (int i = 0; i < N_BUCKETS; ++i)
+	{
+		nBelow += buckets_[i];
+		if (nBelow >= rank)
+			return std::min(bucketValue(i), max_);
+	}
+	return max_;
+}
+
+//===========================
+//
+// DETECTIONSTATS
+//
+//===========================
+
+const char* DetectionStats::stageName(Stage stage)
+{
+	static const char* names[N_STAGES] = { "preprocessing", "tracking", "cascade", "svm stage 2", "association", "refinement", "stage 3", "total" };
+	return names[stage];
+}
+
+DetectionStats::DetectionStats() :
+nFrames(0),
+nCandidates(0),
+nAccepted(0),
+nRejected(0),
+nTrackFrames(0),
+maxActiveTracks(0),
+nCacheHits(0),
+nCacheMisses(0),
+nPartialScans(0),
+nBlocks(0),
+nDirtyBlocks(0),
+nRefined(0),
+nRefinementsSkipped(0)
+{
+}
+
+void DetectionStats::merge(const DetectionStats& other)
+{
+	for (int s = 0; s < N_STAGES; ++s)
+		latencies[s].merge(other.latencies[s]);
+	nFrames += other.nFrames;
+	nCandidates += other.nCandidates;
+	nAccepted += other.nAccepted;
+	nRejected += other.nRejected;
+	nTrackFrames += other.nTrackFrames;
+	maxActiveTracks = std::max(maxActiveTracks, other.maxActiveTracks);
+	nCacheHits += other.nCacheHits;
+	nCacheMisses += other.nCacheMisses;
+	nPartialScans += other.nPartialScans;
+	nBlocks += other.nBlocks;
+	nDirtyBlocks += other.nDirtyBlocks;
+	nRefined += other.nRefined;
+	nRefinementsSkipped += other.nRefinementsSkipped;
+}
+
+void DetectionStats::print(std::ostream& out) const
+{
+	const std::ios::fmtflags flags = out.flags();
+	const std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision(3);
+	out << std::left << std::setw(16) << "stage (ms)" << std::right << std::setw(10) << "count" << std::setw(10) << "mean"
+		<< std::setw(10) << "p50" << std::setw(10) << "p95" << std::setw(10) << "p99" << std::setw(10) << "max" << "\n";
+	for (int s = 0; s < N_STAGES; ++s)
+	{
+		const LatencyHistogram& h = latencies[s];
+		out << std::left << std::setw(16) << stageName((Stage)s) << std::right << std::setw(10) << h.count() << std::setw(10) << h.mean()
+			<< std::setw(10) << h.percentile(50.) << std::setw(10) << h.percentile(95.) << std::setw(10) << h.percentile(99.)
+			<< std::setw(10) << h.max() << "\n";
+	}
+	out << std::setprecision(2);
+	out << "frames: " << nFrames << ", fps: " << fps() << "\n";
+	out << "candidates: " << nCandidates << ", svm accepted: " << nAccepted << ", svm rejected: " << nRejected << "\n";
+	out << "active tracks: " << (nFrames > 0 ? (double)nTrackFrames / nFrames : 0.) << " per frame, " << maxActiveTracks << " max" << std::endl;
+	if (nCacheHits + nCacheMisses > 0)
+		out << "result cache: " << nCacheHits << " hits, " << nCacheMisses << " misses" << std::endl;
+	if (nPartialScans > 0)
+		out << "partial scans: " << nPartialScans << ", " << (nBlocks > 0 ? 100. * nDirtyBlocks / nBlocks : 0.) << "% of the blocks rescanned" << std::endl;
+	if (latencies[REFINEMENT].count() > 0)
+		out << "refinement: " << nRefined << " boxes changed, " << nRefinementsSkipped << " skipped over budget" << std::endl;
+	out.flags(flags);
+	out.precision(precision);
+}
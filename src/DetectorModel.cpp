@@ -0,0 +1,448 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+Author: Giovanni Fusco - giofusco@ski.org & Ender Tekin
+
+*/
+
+#include "DetectorModel.h"
+#include "QuantizedSVM.h"
+#include "svm.h"
+#include <opencv2/objdetect/objdetect.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+
+/// @class DetectorModel::CascadeDetector
+/// cascade detector using lbp features, used as first stage detector.
+/// cv::CascadeClassifier::detectMultiScale keeps scratch state in the classifier, so each scan borrows an
+/// instance from a pool. Instances are created on demand from the cascade file contents, read once.
+class DetectorModel::CascadeDetector
+{
+public:
+
+	/// Ctor
+	/// @param[in] cascadeFileName name of file to load the cascade from
+	/// @param[in] minWinSize minimum size of the scanning window
+	/// @param[in] maxWinSize maximum size of the scanning window
+	/// @param[in] scaleFactor scale factor to use for multi-scale detection
+	/// @throw std::runtime_error if unable to allocate memory of read the cascade file
+	CascadeDetector(const std::string& cascadeFileName, const cv::Size& minWinSize, const cv::Size& maxWinSize, float scaleFactor) throw (std::runtime_error) :
+		minSz_(minWinSize),
+		maxSz_(maxWinSize),
+		scaleFactor_(scaleFactor),
+		cascadeFileName_(cascadeFileName)
+	{
+		std::ifstream file(cascadeFileName_, std::ios::in | std::ios::binary);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("CascadeDetector :: Unable to load cascade detector from file " + cascadeFileName);
+		}
+		cascadeData_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		// check that cascade detector can be loaded
+		idle_.push_back(createInstance());
+	}
+
+	/// Dtor
+	~CascadeDetector() = default;
+
+	/*!
+	 * First stage of cascade classifier
+	 * @param[in] frame frame to process
+	 * @return a vector of detections candidates
+	 */
+	std::vector<cv::Rect> detect(const cv::Mat& frame) const
+	{
+		return detect(frame, scaleFactor_, minSz_, maxSz_);
+	}
+
+	/*!
+	* First stage of cascade classifier, overrides the default min & max search windows sizes
+	* @param[in] frame frame to process
+	* @param[in] scale factor for multiscale detection
+	* @return a vector of detections candidates
+	*/
+	std::vector<cv::Rect> detect(const cv::Mat& frame, float scaleFactor, cv::Size minSize, cv::Size maxSize) const
+	{
+		return detect(frame, scaleFactor, minSize, maxSize, cv::Mat());
+	}
+
+	/*!
+	* First stage of cascade classifier, skipping the windows centered on masked pixels
+	* @param[in] frame frame to process
+	* @param[in] scale factor for multiscale detection
+	* @param[in] mask if not empty, CV_8UC1 mask of the size of frame, zero where windows are skipped
+	* @return a vector of detections candidates
+	*/
+	std::vector<cv::Rect> detect(const cv::Mat& frame, float scaleFactor, cv::Size minSize, cv::Size maxSize, const cv::Mat& mask) const
+	{
+		std::vector<cv::Rect> rawHits;
+		return detect(frame, scaleFactor, minSize, maxSize, mask, cv::Mat(), rawHits);
+	}
+
+	/*!
+	* First stage of cascade classifier, only scanning the windows that overlap changed pixels. The hits of the previous scan
+	* that do not overlap them are kept, and grouped with the new ones.
+	* @param[in] frame frame to process
+	* @param[in] scale factor for multiscale detection
+	* @param[in] mask if not empty, CV_8UC1 mask of the size of frame, zero where windows are skipped
+	* @param[in] dirty if not empty, CV_8UC1 map of the size of frame, nonzero where the frame changed. If empty, every window is scanned.
+	* @param[in,out] rawHits ungrouped windows found by the previous scan, replaced by those of this one
+	* @return a vector of detections candidates
+	*/
+	std::vector<cv::Rect> detect(const cv::Mat& frame, float scaleFactor, cv::Size minSize, cv::Size maxSize, const cv::Mat& mask, const cv::Mat& dirty, std::vector<cv::Rect>& rawHits) const
+	{
+		if (dirty.empty())
+		{
+			rawHits.clear();
+		}
+		else	//the windows over changed pixels are scanned again
+		{
+			const cv::Rect frameRect(0, 0, dirty.cols, dirty.rows);
+			rawHits.erase(std::remove_if(rawHits.begin(), rawHits.end(), [&dirty, &frameRect](const cv::Rect& hit){ return cv::countNonZero(dirty(hit & frameRect)) > 0; }), rawHits.end());
+		}
+		if ((mask.empty() || (cv::countNonZero(mask) > 0)) && (dirty.empty() || (cv::countNonZero(dirty) > 0)))	//anything to search
+		{
+			Lease cascade(*this);
+			//instances go back to the pool after the scan, so the generator is set on every scan, even if there is no mask
+			cascade->setMaskGenerator((mask.empty() && dirty.empty()) ? cv::Ptr<cv::CascadeClassifier::MaskGenerator>() :
+				cv::Ptr<cv::CascadeClassifier::MaskGenerator>(new WindowMaskGenerator(mask, dirty, cascade->getOriginalWindowSize())));
+			std::vector<cv::Rect> hits;
+			cascade->detectMultiScale(frame, hits, scaleFactor, 0, 0, minSize, maxSize);
+			rawHits.insert(rawHits.end(), hits.begin(), hits.end());
+		}
+		std::vector<cv::Rect> rois(rawHits);
+		groupRectangles(rois, 1);
+		if (!mask.empty())	//grouping moves the candidates
+		{
+			rois.erase(std::remove_if(rois.begin(), rois.end(), [&mask](const cv::Rect& roi){ return !DetectorModel::isSearched(mask, roi); }), rois.end());
+		}
+		return rois;
+	}
+private:
+	/// Resamples the region mask and the map of changed pixels to each pyramid level, so that the cascade skips the windows
+	/// centered on masked pixels, and the windows that do not overlap changed pixels.
+	/// The cascade checks the mask at the top-left corner of each window, so the level mask is shifted by half a window,
+	/// and the changed pixels are spread over the window that starts at each pixel.
+	class WindowMaskGenerator : public cv::CascadeClassifier::MaskGenerator
+	{
+	public:
+		WindowMaskGenerator(const cv::Mat& mask, const cv::Mat& dirty, cv::Size window) : mask_(mask), dirty_(dirty), window_(window) {}
+
+		cv::Mat generateMask(const cv::Mat& src)
+		{
+			cv::Mat levelMask;
+			cv::Mat resized;
+			if (!mask_.empty())
+			{
+				//a level pixel stays searched if any pixel it covers is searched
+				cv::resize(mask_, resized, src.size(), 0, 0, cv::INTER_AREA);
+				levelMask = cv::Mat::zeros(src.size(), CV_8UC1);
+				const cv::Point offset(window_.width / 2, window_.height / 2);
+				if ((offset.x < src.cols) && (offset.y < src.rows))
+				{
+					const cv::Size size(src.cols - offset.x, src.rows - offset.y);
+					resized(cv::Rect(offset, size)).copyTo(levelMask(cv::Rect(cv::Point(0, 0), size)));
+				}
+			}
+			if (!dirty_.empty())
+			{
+				//a level pixel is changed if any pixel it covers is changed, and a window is scanned if any of its pixels is changed
+				cv::Mat levelDirty;
+				cv::resize(dirty_, resized, src.size(), 0, 0, cv::INTER_AREA);
+				cv::dilate(resized, levelDirty, cv::Mat::ones(window_, CV_8UC1), cv::Point(0, 0));
+				if (levelMask.empty())
+					levelMask = levelDirty;
+				else
+					cv::min(levelMask, levelDirty, levelMask);
+			}
+			return levelMask;
+		}
+	private:
+		const cv::Mat mask_;		//< mask at the size of the scanned frame, possibly empty
+		const cv::Mat dirty_;		//< changed pixels at the size of the scanned frame, possibly empty
+		const cv::Size window_;		//< cascade window size
+	};
+
+
+	/// Borrows a cascade instance from the pool for the lifetime of the lease
+	class Lease
+	{
+	public:
+		explicit Lease(const CascadeDetector& owner) : owner_(owner), pCascade_(owner.acquire()) {}
+		~Lease() { owner_.release(std::move(pCascade_)); }
+		cv::CascadeClassifier* operator->() const { return pCascade_.get(); }
+	private:
+		const CascadeDetector& owner_;
+		std::unique_ptr<cv::CascadeClassifier> pCascade_;
+	};
+
+	/// @return a new cascade instance loaded from the file contents
+	/// @throw std::runtime_error if the cascade cannot be loaded
+	std::unique_ptr<cv::CascadeClassifier> createInstance() const
+	{
+		std::unique_ptr<cv::CascadeClassifier> pCascade(new cv::CascadeClassifier());
+		cv::FileStorage fs(cascadeData_, cv::FileStorage::READ | cv::FileStorage::MEMORY);
+		if (!fs.isOpened() || !pCascade->read(fs.getFirstTopLevelNode()))
+		{
+			// old style cascades can only be loaded from a file
+			if (!pCascade->load(cascadeFileName_))
+			{
+				throw std::runtime_error("CascadeDetector :: Unable to load cascade detector from file " + cascadeFileName_);
+			}
+		}
+		return pCascade;
+	}
+
+	/// @return an idle cascade instance, or a new one if all are in use
+	std::unique_ptr<cv::CascadeClassifier> acquire() const
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!idle_.empty())
+			{
+				std::unique_ptr<cv::CascadeClassifier> pCascade = std::move(idle_.back());
+				idle_.pop_back();
+				return pCascade;
+			}
+		}
+		return createInstance();
+	}
+
+	/// returns a cascade instance to the pool
+	void release(std::unique_ptr<cv::CascadeClassifier> pCascade) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		idle_.push_back(std::move(pCascade));
+	}
+
+	const cv::Size minSz_;  //< min win size
+	const cv::Size maxSz_;  //< max win size
+	const float scaleFactor_;     //< scale factor
+	const std::string cascadeFileName_;	//< file the cascade was loaded from
+	std::string cascadeData_;			//< contents of the cascade file
+	mutable std::mutex mutex_;			//< protects idle_
+	mutable std::vector<std::unique_ptr<cv::CascadeClassifier>> idle_;	//< cascade instances not in use
+};  // DetectorModel::CascadeDetector
+
+
+/// @class DetectorModel::SVMClassifier
+/// svm detector using HoG features, used as second stage classifier
+class DetectorModel::SVMClassifier
+{
+public:
+	/// Ctor
+	/// @param[in] svmModelFileName name of file to load the svm model from
+	/// @param[in] hogWinSize size of the window to calculate HoG
+	/// @param[in] quantize whether to classify with int8 descriptors and support vectors
+	/// @param[in] scale descriptor quantization scale, 0 to derive it from the support vectors
+	/// @throw std::runtime_error if unable to allocate memory of read the cascade file, or the model cannot be quantized
+	SVMClassifier(const std::string& svmModelFileName, const cv::Size& hogWinSize, bool quantize, float scale) throw (std::runtime_error) :
+		hogWinSz_(hogWinSize),
+		pModel_(svm_load_model(svmModelFileName.c_str())),
+		hog_(hogWinSize,            //winSize
+		cv::Size(16, 16),       //blockSize
+		cv::Size(4, 4),         //blockStride
+		cv::Size(8, 8),         //cellSize
+		9,                     //nbins
+		1,                     //derivAperture
+		-1,                    //winSigma,
+		cv::HOGDescriptor::L2Hys,  //histogramNormType,
+		.2,                    //L2HysThreshold,
+		true,                  //gammaCorrection
+		1                      //nLevels
+		)
+	{
+		//check that svm model was loaded successfully
+		if (!pModel_)
+		{
+			throw std::runtime_error("SVMDetector :: Unable to load svm model from file " + svmModelFileName);
+		}
+		if (quantize)
+		{
+			if (!QuantizedSVM::supports(pModel_.get()))
+			{
+				throw std::runtime_error("SVMDetector :: Unable to quantize svm model " + svmModelFileName + ", only binary models with probability estimates and a linear, polynomial, RBF or sigmoid kernel can be");
+			}
+			pQuantized_.reset(new QuantizedSVM(pModel_.get(), scale));
+		}
+	}
+
+	/// Dtor
+	~SVMClassifier() = default;
+
+	/*!
+	 * Verifies the ROIs detected in the first stage using SVM + HOG
+	 * @param[in] patch patch to classify
+	 * @return a pair of values indicating the estimated class and confidence of the patch.
+	 * @throw runtime error if unable to allocate memory for this stage
+	 */
+	std::pair<int, double> classify(const cv::Mat& patch) const
+	{
+		double prob_est[2];
+
+		std::vector<float> desc = describe(patch);
+		if (pQuantized_)
+		{
+			const int label = pQuantized_->predictProbability(desc, prob_est);
+			return std::make_pair(label, prob_est[label < 0]);
+		}
+
+		//TODO: The index is set from scratch for each patch. If descriptor sizes are the same for each window, the next two can be optimized by setting it once as member variables
+		std::vector<svm_node> x;
+		x.resize(desc.size() + 1);
+
+		for (int d = 0; d < desc.size(); d++){
+			x[d].index = d + 1;  // Index starts from 1; Pre-computed kernel starts from 0
+			x[d].value = desc[d];
+		}
+
+		x[desc.size()].index = -1;
+		desc.clear();
+
+		int label = round(svm_predict_probability(pModel_.get(), x.data(), prob_est));
+		return std::make_pair(label, prob_est[label < 0]);
+	}
+
+	/*!
+	 * Computes the HoG descriptor of a patch, resized to the HoG window
+	 * @param[in] patch patch to describe
+	 * @return the descriptor
+	 */
+	std::vector<float> describe(const cv::Mat& patch) const
+	{
+		std::vector<float> desc;
+		cv::Mat resized(hogWinSz_, CV_32FC1);
+		cv::resize(patch, resized, hogWinSz_);
+		hog_.compute(resized, desc);
+		return desc;
+	}
+private:
+	const cv::Size hogWinSz_;                   //< min win size
+	const std::unique_ptr<svm_model> pModel_;   //< svm model
+	const cv::HOGDescriptor hog_;				//< hog feature extractor
+	std::unique_ptr<QuantizedSVM> pQuantized_;	//< integer version of the svm model, null if the model is evaluated in floating point
+};  // DetectorModel::SVMDetector
+
+
+//===========================
+//
+// DETECTORMODEL
+//
+//===========================
+
+DetectorModel::DetectorModel(const std::string& yamlConfigFile, const std::string& classifiersFolder) throw(std::runtime_error) :
+DetectorModel(DetectionParams(yamlConfigFile, classifiersFolder))
+{
+}
+
+DetectorModel::DetectorModel(const DetectionParams& params) throw(std::runtime_error) :
+params_(params)
+{
+	try
+	{
+		pCascadeDetector = std::unique_ptr<CascadeDetector>(new CascadeDetector(params_.cascadeFile, params_.cascadeMinWin, params_.cascadeMaxWin, params_.cascadeScaleFactor));
+		pSVMClassifier = std::unique_ptr<SVMClassifier>(new SVMClassifier(params_.svmModelFile, params_.hogWinSize, params_.quantizeSVM, params_.svmQuantizationScale));
+		if (params_.useThreeStages()){
+			pSVMClassifier2 = std::unique_ptr<SVMClassifier>(new SVMClassifier(params_.svmModelFile2, params_.hogWinSize, params_.quantizeSVM, params_.svmQuantizationScale));
+		}
+		if (!params_.maskFile.empty()){
+			maskImage_ = cv::imread(params_.maskFile, cv::IMREAD_GRAYSCALE);
+			if (maskImage_.empty())
+				throw std::runtime_error("Unable to load region mask from file " + params_.maskFile);
+		}
+	}
+	catch (std::exception& err)
+	{
+		throw std::runtime_error(std::string("OBJDETECTOR ERROR :: ") + err.what());
+	}
+}
+
+DetectorModel::~DetectorModel() = default;
+
+std::vector<cv::Rect> DetectorModel::detectCandidates(const cv::Mat& frame) const
+{
+	return pCascadeDetector->detect(frame);
+}
+
+std::vector<cv::Rect> DetectorModel::detectCandidates(const cv::Mat& frame, float scaleFactor, cv::Size minSize, cv::Size maxSize, const cv::Mat& mask) const
+{
+	return pCascadeDetector->detect(frame, scaleFactor, minSize, maxSize, mask);
+}
+
+std::vector<cv::Rect> DetectorModel::detectCandidates(const cv::Mat& frame, float scaleFactor, cv::Size minSize, cv::Size maxSize, const cv::Mat& mask, const cv::Mat& dirty, std::vector<cv::Rect>& rawHits) const
+{
+	return pCascadeDetector->detect(frame, scaleFactor, minSize, maxSize, mask, dirty, rawHits);
+}
+
+cv::Mat DetectorModel::regionMask(cv::Size frameSize) const
+{
+	if (!params_.hasRegionMask() || (frameSize.area() <= 0))
+		return cv::Mat();
+	std::lock_guard<std::mutex> lock(regionMasksMutex_);
+	cv::Mat& mask = regionMasks_[std::make_pair(frameSize.width, frameSize.height)];
+	if (mask.empty())
+	{
+		if (maskImage_.empty())
+		{
+			mask = cv::Mat(frameSize, CV_8UC1, cv::Scalar(255));
+		}
+		else
+		{
+			cv::resize(maskImage_, mask, frameSize, 0, 0, cv::INTER_NEAREST);
+			cv::threshold(mask, mask, 0, 255, cv::THRESH_BINARY);
+		}
+		std::vector<std::vector<cv::Point> > polygons;
+		for (const auto& polygon : params_.maskPolygons)
+		{
+			std::vector<cv::Point> points;
+			for (const auto& pt : polygon)
+			{
+				points.push_back(cv::Point(cvRound(pt.x * frameSize.width), cvRound(pt.y * frameSize.height)));
+			}
+			polygons.push_back(points);
+		}
+		if (!polygons.empty())
+			cv::fillPoly(mask, polygons, cv::Scalar(0));
+	}
+	return mask;
+}
+
+bool DetectorModel::isSearched(const cv::Mat& mask, const cv::Rect& roi)
+{
+	if (mask.empty())
+		return true;
+	const int x = std::min(std::max(roi.x + roi.width / 2, 0), mask.cols - 1);
+	const int y = std::min(std::max(roi.y + roi.height / 2, 0), mask.rows - 1);
+	return (0 != mask.at<unsigned char>(y, x));
+}
+
+std::pair<int, double> DetectorModel::classify(const cv::Mat& patch) const
+{
+	return pSVMClassifier->classify(patch);
+}
+
+std::pair<int, double> DetectorModel::classifyStage3(const cv::Mat& patch) const
+{
+	assert(pSVMClassifier2);
+	return pSVMClassifier2->classify(patch);
+}
+
+std::vector<float> DetectorModel::describe(const cv::Mat& patch) const
+{
+	return pSVMClassifier->describe(patch);
+}
@@ -0,0 +1,323 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "Evaluation.h"
+#include "ObjDetector.h"
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+
+namespace
+{
+	/// @return values, or a list holding defaultValue if values is empty
+	template<typename T>
+	std::vector<T> valuesOr(const std::vector<T>& values, T defaultValue)
+	{
+		return (values.empty() ? std::vector<T>(1, defaultValue) : values);
+	}
+}   //::<anon>
+
+RoiFile readRoiFile(const std::string& fileName) throw(std::runtime_error)
+{
+	std::ifstream file(fileName);
+	if (!file.is_open())
+		throw std::runtime_error("Unable to open ROIs file " + fileName);
+
+	RoiFile roiFile;
+	if (!std::getline(file, roiFile.input) || !std::getline(file, roiFile.label))
+		throw std::runtime_error("ROIs file " + fileName + " has no header");
+
+	std::string line;
+	int lineNumber = 2;
+	while (std::getline(file, line))
+	{
+		++lineNumber;
+		std::istringstream fields(line);
+		std::vector<double> values;
+		double value;
+		while (fields >> value)
+			values.push_back(value);
+		if (values.empty())
+			continue;
+		if ((2 == values.size()) && (0 == roiFile.frameSize.area()))	//frame height and width, before the first ROI
+		{
+			roiFile.frameSize = cv::Size((int)values[1], (int)values[0]);
+		}
+		else if (values.size() >= 5)
+		{
+			const cv::Rect roi(cv::Point(cvRound(values[1]), cvRound(values[2])), cv::Point(cvRound(values[3]), cvRound(values[4])));
+			roiFile.rois[(int)values[0]].push_back(roi);
+		}
+		else
+		{
+			throw std::runtime_error("ROIs file " + fileName + ": malformed line " + std::to_string(lineNumber));
+		}
+	}
+	return roiFile;
+}
+
+double intersectionOverUnion(const cv::Rect& r1, const cv::Rect& r2)
+{
+	const double intersection = (r1 & r2).area();
+	const double union_ = (double)r1.area() + r2.area() - intersection;
+	return (union_ > 0. ? intersection / union_ : 0.);
+}
+
+void MatchCounts::add(const MatchCounts& other)
+{
+	nTruePositives += other.nTruePositives;
+	nFalsePositives += other.nFalsePositives;
+	nFalseNegatives += other.nFalseNegatives;
+}
+
+MatchCounts matchDetections(const std::vector<cv::Rect>& detections, const std::vector<cv::Rect>& truth, double minIoU)
+{
+	struct Pair
+	{
+		double iou;
+		std::size_t detection, annotation;
+	};
+	std::vector<Pair> pairs;
+	for (std::size_t i = 0; i < detections.size(); ++i)
+	{
+		for (std::size_t j = 0; j < truth.size(); ++j)
+		{
+			const double iou = intersectionOverUnion(detections[i], truth[j]);
+			if (iou >= minIoU)
+				pairs.push_back({ iou, i, j });
+		}
+	}
+	std::sort(pairs.begin(), pairs.end(), [](const Pair& p1, const Pair& p2){ return p1.iou > p2.iou; });
+
+	std::vector<char> isDetectionMatched(detections.size(), false), isAnnotationMatched(truth.size(), false);
+	MatchCounts counts = { 0, 0, 0 };
+	for (const auto& pair : pairs)
+	{
+		if (isDetectionMatched[pair.detection] || isAnnotationMatched[pair.annotation])
+			continue;
+		isDetectionMatched[pair.detection] = true;
+		isAnnotationMatched[pair.annotation] = true;
+		++counts.nTruePositives;
+	}
+	counts.nFalsePositives = detections.size() - counts.nTruePositives;
+	counts.nFalseNegatives = truth.size() - counts.nTruePositives;
+	return counts;
+}
+
+std::vector<EvaluationSetting> makeSettings(const DetectionParams& base, const Sweep& sweep)
+{
+	const auto trackModes = valuesOr(sweep.trackModes, 1);
+	const auto cascadeScaleFactors = valuesOr(sweep.cascadeScaleFactors, base.cascadeScaleFactor);
+	const auto scalingFactors = valuesOr(sweep.scalingFactors, base.scalingFactor);
+	const auto svmThresholds = valuesOr(sweep.svmThresholds, base.SVMThreshold);
+	const auto minWinScales = valuesOr(sweep.minWinScales, 1.f);
+	const auto maxWinFactors = valuesOr(sweep.maxWinFactors, 0.f);	//0: scaled as the minimum window
+	const auto quantizeModes = valuesOr(sweep.quantizeModes, (int)base.quantizeSVM);
+	const auto deadlines = valuesOr(sweep.deadlines, -1.);
+
+	std::vector<EvaluationSetting> settings;
+	for (const auto doTrack : trackModes)
+	for (const auto cascadeScaleFactor : cascadeScaleFactors)
+	for (const auto scalingFactor : scalingFactors)
+	for (const auto svmThreshold : svmThresholds)
+	for (const auto minWinScale : minWinScales)
+	for (const auto maxWinFactor : maxWinFactors)
+	for (const auto quantize : quantizeModes)
+	for (const auto deadline : deadlines)
+	{
+		EvaluationSetting setting = { std::string(), base, doTrack != 0, deadline };
+		DetectionParams& params = setting.params;
+		params.cascadeScaleFactor = cascadeScaleFactor;
+		params.scalingFactor = scalingFactor;
+		params.SVMThreshold = svmThreshold;
+		params.cascadeMinWin = cv::Size(cvRound(base.cascadeMinWin.width * minWinScale), cvRound(base.cascadeMinWin.height * minWinScale));
+		params.cascadeMaxWin = (maxWinFactor > 0.f ?
+			cv::Size(cvRound(params.cascadeMinWin.width * maxWinFactor), cvRound(params.cascadeMinWin.height * maxWinFactor)) :
+			cv::Size(cvRound(base.cascadeMaxWin.width * minWinScale), cvRound(base.cascadeMaxWin.height * minWinScale)));
+		params.quantizeSVM = (quantize != 0);
+
+		//only the swept values are named, the others are those of the config file
+		std::ostringstream name;
+		name << (setting.doTrack ? "track" : "notrack");
+		if (!sweep.cascadeScaleFactors.empty())
+			name << " cs=" << cascadeScaleFactor;
+		if (!sweep.scalingFactors.empty())
+			name << " sf=" << scalingFactor;
+		if (!sweep.svmThresholds.empty())
+			name << " thr=" << svmThreshold;
+		if (!sweep.minWinScales.empty())
+			name << " win=" << minWinScale;
+		if (!sweep.maxWinFactors.empty())
+			name << " maxwin=" << maxWinFactor;
+		if (!sweep.quantizeModes.empty())
+			name << (params.quantizeSVM ? " int8" : " float");
+		if (!sweep.deadlines.empty())
+			name << " dl=" << deadline;
+		setting.name = name.str();
+		settings.push_back(setting);
+	}
+	return settings;
+}
+
+std::vector<cv::Mat> loadClip(const std::string& input, int maxDim, int maxFrames) throw(std::runtime_error)
+{
+	cv::VideoCapture vc(input);
+	if (!vc.isOpened())
+		throw std::runtime_error("Unable to open input " + input);
+	std::vector<cv::Mat> frames;
+	cv::Mat frame;
+	while (((maxFrames <= 0) || ((int)frames.size() < maxFrames)) && vc.read(frame))
+	{
+		const double scaleFactor = (double)maxDim / std::max(frame.cols, frame.rows);
+		cv::Mat resized;	//the decoder reuses its buffer
+		cv::resize(frame, resized, cv::Size(cvRound(frame.cols * scaleFactor), cvRound(frame.rows * scaleFactor)));
+		frames.push_back(resized);
+	}
+	if (frames.empty())
+		throw std::runtime_error("No frame decoded from " + input);
+	return frames;
+}
+
+EvaluationResult evaluate(const EvaluationSetting& setting, const std::vector<cv::Mat>& frames, const RoiFile& truth, double minIoU) throw(std::runtime_error)
+{
+	ObjDetector detector(std::make_shared<const DetectorModel>(setting.params));
+	if (setting.deadline >= 0.)
+		detector.setDeadline(setting.deadline);
+
+	EvaluationResult result = { setting.name, { 0, 0, 0 }, DetectionStats() };
+	const std::vector<cv::Rect> noRoi;
+	const float scalingFactor = (setting.params.scalingFactor > 0.f ? setting.params.scalingFactor : 1.f);
+	for (std::size_t i = 0; i < frames.size(); ++i)
+	{
+		//detections are in the coordinates of the frame rescaled by the detector, annotations in those of the ROIs file
+		cv::Mat frame = frames[i];	//header only, the detector does not write to the pixels
+		const cv::Size frameSize = frame.size();
+		const double sx = (truth.frameSize.area() > 0 ? (double)truth.frameSize.width / frameSize.width : 1.) / scalingFactor;
+		const double sy = (truth.frameSize.area() > 0 ? (double)truth.frameSize.height / frameSize.height : 1.) / scalingFactor;
+		std::vector<cv::Rect> detections;
+		for (const auto& det : detector.detect(frame, setting.doTrack))
+		{
+			detections.push_back(cv::Rect(cv::Point(cvRound(det.roi.x * sx), cvRound(det.roi.y * sy)), cv::Point(cvRound(det.roi.br().x * sx), cvRound(det.roi.br().y * sy))));
+		}
+		const auto it = truth.rois.find((int)i + 1);
+		result.counts.add(matchDetections(detections, (it == truth.rois.end() ? noRoi : it->second), minIoU));
+	}
+	result.stats = detector.getStats();
+	return result;
+}
+
+std::vector<Clip> loadClips(const std::string& listFileName, int maxDim, int maxFrames) throw(std::runtime_error)
+{
+	std::ifstream listFile(listFileName);
+	if (!listFile.is_open())
+		throw std::runtime_error("Unable to open clip list " + listFileName);
+	std::vector<Clip> clips;
+	std::string line;
+	while (std::getline(listFile, line))
+	{
+		std::istringstream fields(line);
+		std::string input, truthFile;
+		if (!(fields >> input) || ('#' == input[0]))
+			continue;
+		if (!(fields >> truthFile))
+			throw std::runtime_error("Clip list " + listFileName + ": no ROIs file for " + input);
+		Clip clip;
+		clip.input = input;
+		clip.truth = readRoiFile(truthFile);
+		clip.frames = loadClip(input, maxDim, maxFrames);
+		clips.push_back(clip);
+	}
+	if (clips.empty())
+		throw std::runtime_error("Clip list " + listFileName + " is empty");
+	return clips;
+}
+
+EvaluationResult evaluate(const EvaluationSetting& setting, const std::vector<Clip>& clips, double minIoU) throw(std::runtime_error)
+{
+	EvaluationResult result = { setting.name, { 0, 0, 0 }, DetectionStats() };
+	for (const auto& clip : clips)
+	{
+		const EvaluationResult clipResult = evaluate(setting, clip.frames, clip.truth, minIoU);
+		result.counts.add(clipResult.counts);
+		result.stats.merge(clipResult.stats);
+	}
+	return result;
+}
+
+std::vector<std::size_t> paretoFront(const std::vector<EvaluationResult>& results)
+{
+	std::vector<std::size_t> order(results.size());
+	for (std::size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	//fastest first, and the most accurate first among equally fast ones
+	std::sort(order.begin(), order.end(), [&results](std::size_t i, std::size_t j)
+	{
+		const double fps1 = results[i].stats.fps(), fps2 = results[j].stats.fps();
+		return (fps1 != fps2 ? fps1 > fps2 : results[i].counts.f1() > results[j].counts.f1());
+	});
+	std::vector<std::size_t> front;
+	double bestF1 = -1.;
+	for (const auto i : order)	//a result is on the front if it is more accurate than every faster one
+	{
+		if (results[i].counts.f1() > bestF1)
+		{
+			front.push_back(i);
+			bestF1 = results[i].counts.f1();
+		}
+	}
+	std::reverse(front.begin(), front.end());
+	return front;
+}
+
+void printResults(std::ostream& out, const std::vector<EvaluationResult>& results)
+{
+	const auto front = paretoFront(results);
+	std::size_t nameWidth = 7;
+	for (const auto& result : results)
+		nameWidth = std::max(nameWidth, result.name.size());
+
+	auto printHeader = [&]()
+	{
+		out << "  " << std::left << std::setw(nameWidth) << "setting" << std::right
+			<< std::setw(8) << "P" << std::setw(8) << "R" << std::setw(8) << "F1" << std::setw(9) << "FPS"
+			<< std::setw(10) << "cascade" << std::setw(10) << "stage2" << std::setw(10) << "tracking" << std::setw(10) << "total" << std::endl;
+	};
+	auto printRow = [&](std::size_t i)
+	{
+		const auto& result = results[i];
+		const bool isOptimal = (std::find(front.begin(), front.end(), i) != front.end());
+		out << (isOptimal ? "* " : "  ") << std::left << std::setw(nameWidth) << result.name << std::right << std::fixed
+			<< std::setprecision(3) << std::setw(8) << result.counts.precision() << std::setw(8) << result.counts.recall() << std::setw(8) << result.counts.f1()
+			<< std::setprecision(1) << std::setw(9) << result.stats.fps()
+			<< std::setprecision(2) << std::setw(10) << result.stats.latencies[DetectionStats::CASCADE].mean()
+			<< std::setw(10) << result.stats.latencies[DetectionStats::STAGE2].mean()
+			<< std::setw(10) << result.stats.latencies[DetectionStats::TRACKING].mean()
+			<< std::setw(10) << result.stats.latencies[DetectionStats::TOTAL].mean() << std::endl;
+		out.unsetf(std::ios::floatfield);
+	};
+
+	out << "All settings (stage times: mean ms per frame):" << std::endl;
+	printHeader();
+	for (std::size_t i = 0; i < results.size(); ++i)
+		printRow(i);
+	out << std::endl << "Pareto front, F1 vs FPS:" << std::endl;
+	printHeader();
+	for (const auto i : front)
+		printRow(i);
+}
@@ -0,0 +1,97 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "LatencyController.h"
+#include <algorithm>
+
+namespace
+{
+	static const double LATENCY_SMOOTHING = .3;		//< weight of the newest frame in the smoothed latency
+	static const double RECOVERY_MARGIN = .6;		//< a frame is well within budget below this fraction of the deadline
+	static const int MIN_FRAMES_AT_LEVEL = 5;		//< frames to observe after a level change before changing again
+	static const int RECOVERY_FRAMES = 15;			//< consecutive frames well within budget before recovering a level
+	static const float COARSE_SCALE_STEP = 2.f;		//< level 1+: multiplies the pyramid step (scaleFactor - 1)
+	static const float MIN_WIN_GROWTH = 1.5f;		//< level 2+: growth of the minimum window
+	static const unsigned FULL_SCAN_INTERVAL = 4;	//< level 3: the whole frame is scanned once every this many frames
+	static const unsigned SPARSE_SCAN_INTERVAL = 8;	//< level 4: the whole frame is scanned once every this many frames
+}   //::<anon>
+
+LatencyController::LatencyController(double deadline, int maxLevel) :
+deadline_(std::max(0., deadline)),
+maxLevel_(std::min(std::max(0, maxLevel), (int)MAX_LEVEL)),
+smoothedLatency_(0.),
+nFramesAtLevel_(0),
+nFramesWithinBudget_(0),
+stats_({ 0, 0, 0, 0 })
+{
+}
+
+LatencyController::Plan LatencyController::plan(const DetectionParams& params) const
+{
+	Plan p = { true, false, params.cascadeScaleFactor, params.cascadeMinWin, params.cascadeMaxWin };
+	if (!isEnabled())
+		return p;
+
+	const int level = stats_.level;
+	const unsigned frame = (unsigned)stats_.nFrames;	//index of the frame being planned
+	if (level >= 1)
+	{
+		p.scaleFactor = 1.f + COARSE_SCALE_STEP * (params.cascadeScaleFactor - 1.f);
+	}
+	if (level >= 2)
+	{
+		p.minWin = cv::Size(cvRound(params.cascadeMinWin.width * MIN_WIN_GROWTH), cvRound(params.cascadeMinWin.height * MIN_WIN_GROWTH));
+		p.maxWin = cv::Size(std::max(p.maxWin.width, p.minWin.width), std::max(p.maxWin.height, p.minWin.height));
+	}
+	if (level >= 3)
+	{
+		const unsigned interval = (level >= 4 ? SPARSE_SCAN_INTERVAL : FULL_SCAN_INTERVAL);
+		p.scanTracksOnly = (0 != frame % interval);
+	}
+	if (level >= 4)
+	{
+		p.doScan = (0 == frame % 2);
+	}
+	return p;
+}
+
+void LatencyController::update(double latency)
+{
+	if (!isEnabled())
+		return;
+
+	++stats_.nFrames;
+	if (latency > deadline_)
+		++stats_.nMissed;
+	smoothedLatency_ = (1 == stats_.nFrames ? latency : smoothedLatency_ + LATENCY_SMOOTHING * (latency - smoothedLatency_));
+	nFramesWithinBudget_ = (latency < RECOVERY_MARGIN * deadline_ ? nFramesWithinBudget_ + 1 : 0);
+	++nFramesAtLevel_;
+	if (nFramesAtLevel_ < MIN_FRAMES_AT_LEVEL)
+		return;
+
+	if ((smoothedLatency_ > deadline_) && (stats_.level < maxLevel_))
+	{
+		++stats_.level;
+		stats_.maxLevelReached = std::max(stats_.maxLevelReached, stats_.level);
+		nFramesAtLevel_ = 0;
+		nFramesWithinBudget_ = 0;
+	}
+	else if ((nFramesWithinBudget_ >= RECOVERY_FRAMES) && (stats_.level > 0))
+	{
+		--stats_.level;
+		nFramesAtLevel_ = 0;
+		nFramesWithinBudget_ = 0;
+	}
+}
@@ -78,7 +78,7 @@ namespace
         std::vector<std::uint8_t> fStatus, bStatus;
         //Calculated error of each tracked point
         std::vector<float> error;
-        OpticalFlowData(const cv::Rect& bbox)
+        OpticalFlowData()
         {
             points.reserve(N);
             trackedPoints.reserve(N);
@@ -86,7 +86,10 @@ namespace
             fStatus.reserve(N);
             bStatus.reserve(N);
             error.reserve(N);
-            //Initialize point grid
+        }
+        ///Initializes the point grid inside bbox, keeping the capacity of the vectors
+        void reset(const cv::Rect& bbox)
+        {
             initializePointGrid(points, bbox);
         }
     };
@@ -134,7 +137,16 @@ namespace
     }
 
     
-    std::vector<PointCorrespondence> calculateCorrespondences(const MatUint8 &prevImg, const MatUint8 &aImg, const cv::Rect &bbox)
+    /**
+     * Tracks a grid of points inside bbox forward and backward, and keeps the most reliable ones
+     * @param[in] prevImg previous frame
+     * @param[in] aImg current frame
+     * @param[in] bbox bounding box in the previous frame
+     * @param[in] prior predicted motion, used as the initial flow of every point
+     * @param[out] quality median forward-backward error and NCC of the tracked points
+     * @return correspondences of the points kept
+     */
+    std::vector<PointCorrespondence> calculateCorrespondences(const MatUint8 &prevImg, const MatUint8 &aImg, const cv::Rect &bbox, const MedianFlowPrior& prior, MedianFlowQuality& quality)
     {
         std::vector<PointCorrespondence> correspondences;
         if (bbox.area() < 1)
@@ -146,19 +158,44 @@ namespace
             float dist;
             float ncc;
         };
-        std::vector<CorrespondenceErrors> errors;
+        //scratch buffers are per thread and reused across calls, so that steady-state tracking does not allocate
+        thread_local std::vector<CorrespondenceErrors> errors;
+        errors.clear();
         errors.reserve(N_POINTS);
         
-        OpticalFlowData<N_POINTS> data(bbox);
+        thread_local OpticalFlowData<N_POINTS> data;
+        data.reset(bbox);
         //Calculate forward optical flow
         static const cv::Size OPTICAL_FLOW_WINDOW_SIZE_(21,21);
-        calcOpticalFlowPyrLK(prevImg, aImg, data.points, data.trackedPoints, data.fStatus, data.error, OPTICAL_FLOW_WINDOW_SIZE_, 3);
-        //Calculate backward optical flow
-        calcOpticalFlowPyrLK(aImg, prevImg, data.trackedPoints, data.backTrackedPoints, data.bStatus, data.error, OPTICAL_FLOW_WINDOW_SIZE_, 3);
+        //a confident prediction only leaves a small residual motion to find, so the search can be shallower
+        static const int MAX_LEVEL = 3, MAX_LEVEL_CONFIDENT = 1;
+        static const cv::TermCriteria CRITERIA(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01);
+        static const cv::TermCriteria CRITERIA_CONFIDENT(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 10, 0.03);
+        const int maxLevel = (prior.isConfident ? MAX_LEVEL_CONFIDENT : MAX_LEVEL);
+        const cv::TermCriteria& criteria = (prior.isConfident ? CRITERIA_CONFIDENT : CRITERIA);
+        data.trackedPoints.clear();
+        for (const auto& pt : data.points)
+        {
+            data.trackedPoints.push_back(pt + prior.motion);
+        }
+        calcOpticalFlowPyrLK(prevImg, aImg, data.points, data.trackedPoints, data.fStatus, data.error, OPTICAL_FLOW_WINDOW_SIZE_, maxLevel, criteria, cv::OPTFLOW_USE_INITIAL_FLOW);
+        //Calculate backward optical flow. It must not be seeded with the original points, or the forward-backward error would be
+        //biased towards zero; a confident prediction is undone instead, which is independent of the forward result
+        int backwardFlags = 0;
+        if (prior.isConfident)
+        {
+            data.backTrackedPoints.clear();
+            for (const auto& pt : data.trackedPoints)
+            {
+                data.backTrackedPoints.push_back(pt - prior.motion);
+            }
+            backwardFlags = cv::OPTFLOW_USE_INITIAL_FLOW;
+        }
+        calcOpticalFlowPyrLK(aImg, prevImg, data.trackedPoints, data.backTrackedPoints, data.bStatus, data.error, OPTICAL_FLOW_WINDOW_SIZE_, maxLevel, criteria, backwardFlags);
         //Calculate the NCC error and return the matched pixels
         static const int PATCH_SIZE = 16;
         const cv::Size patchSize(PATCH_SIZE, PATCH_SIZE);
-        MatUint8 patch1(patchSize), patch2(patchSize);
+        thread_local MatUint8 patch1(patchSize), patch2(patchSize);
         //assert(patch1.data != patch2.data);
         for (int i = 0; i < N_POINTS; i++)
         {
@@ -166,7 +203,7 @@ namespace
             if (data.fStatus[i] && data.bStatus[i])
             {
                 //SPEEDUP: Round the pixel and calculate cross correlation directly
-                getRectSubPix( aImg, patchSize, data.points[i], patch1 );
+                getRectSubPix( prevImg, patchSize, data.points[i], patch1 );
                 getRectSubPix( aImg, patchSize, data.trackedPoints[i], patch2 );
                 //Calculate normalized cross correlation
                 assert( patch1.isContinuous() && patch2.isContinuous() );
@@ -182,8 +219,10 @@ namespace
         //Filter the points according to errors
         auto itMedian = calculateMedian(errors.begin(), errors.end(),
                                              [](const CorrespondenceErrors &e1, const CorrespondenceErrors &e2) {return (e1.dist < e2.dist); } );
+        quality.fbError = itMedian->dist;
         itMedian = calculateMedian(errors.begin(), itMedian,
                                         [](const CorrespondenceErrors &e1, const CorrespondenceErrors &e2) {return (e1.ncc < e2.ncc); } );
+        quality.ncc = itMedian->ncc;
         errors.erase(itMedian, errors.end());
         //Return the best matched points
         for (const auto& err : errors)
@@ -198,9 +237,10 @@ namespace
      * @param[in] correspondences set of point correspondences
      * @param[in] previous bounding box.
      * @param[in] maxMotion maximum allowed motion pixel-wise.
+     * @param[out] scale estimated scale change
      * @return new bounding box estimate
      */
-    cv::Rect calculateBoundingBox(const std::vector<PointCorrespondence>&correspondences, const cv::Rect& bbox, float maxMotion)
+    cv::Rect calculateBoundingBox(const std::vector<PointCorrespondence>&correspondences, const cv::Rect& bbox, float maxMotion, float& scale)
     {
         //Get the median motion and scale
         int nPoints = (int) correspondences.size();
@@ -237,7 +277,7 @@ namespace
         //Calculate median motion
         cv::Point2f medianMotion( *calculateMedian(xDisp.begin(), xDisp.end()), *calculateMedian(yDisp.begin(), yDisp.end()) );
         //Calculate median scale
-        float scale = (scales.empty() ? 1.f : *calculateMedian( scales.begin(), scales.end() ) );
+        scale = (scales.empty() ? 1.f : *calculateMedian( scales.begin(), scales.end() ) );
         //Move the box
         const float c = .5f * (scale - 1.f);
         cv::Rect res( round(bbox.x + medianMotion.x - bbox.width * c),
@@ -258,11 +298,24 @@ namespace
 
 cv::Rect trackMedianFlow(const cv::Rect& loc, const MatUint8& prevImg, const MatUint8& currentImg)
 {
+    MedianFlowQuality quality;
+    return trackMedianFlow(loc, prevImg, currentImg, quality);
+}
+
+cv::Rect trackMedianFlow(const cv::Rect& loc, const MatUint8& prevImg, const MatUint8& currentImg, MedianFlowQuality& quality)
+{
+    const MedianFlowPrior noMotion = {cv::Point2f(0.f, 0.f), false};
+    return trackMedianFlow(loc, prevImg, currentImg, noMotion, quality);
+}
+
+cv::Rect trackMedianFlow(const cv::Rect& loc, const MatUint8& prevImg, const MatUint8& currentImg, const MedianFlowPrior& prior, MedianFlowQuality& quality)
+{
+    quality = {0.f, 0.f, 1.f};
     //Calculate estimated motion
-    auto pointCorrespondences = calculateCorrespondences(prevImg, currentImg, loc);
+    auto pointCorrespondences = calculateCorrespondences(prevImg, currentImg, loc, prior, quality);
     //Calculate and return new bounding box, ensuring a minimum number of point correspondences and a maximum
     const float maxMotion = currentImg.cols/ 30; //limit max trackable motion to around 2 degrees for a camera with a 60deg FOV.
-    auto res = calculateBoundingBox(pointCorrespondences, loc , maxMotion);
+    auto res = calculateBoundingBox(pointCorrespondences, loc , maxMotion, quality.scale);
     //ensure box is still inside the frame
     res &= cv::Rect(0, 0, currentImg.cols, currentImg.rows);
 
@@ -0,0 +1,136 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ModelWatcher.h"
+#include <chrono>
+#include <exception>
+#include <sys/stat.h>
+
+ModelWatcher::ModelWatcher(const std::string& yamlConfigFile, const std::string& classifiersFolder, std::shared_ptr<const DetectorModel> model, Callback onReload, unsigned int periodMs) :
+configFile_(yamlConfigFile),
+classifiersFolder_(classifiersFolder),
+onReload_(onReload),
+periodMs_(periodMs),
+model_(model),
+stop_(false)
+{
+	if (model_)
+		stamps_ = stampFiles(model_->params());
+	if (periodMs_ > 0)
+		thread_ = std::thread(&ModelWatcher::watchLoop, this);
+}
+
+ModelWatcher::~ModelWatcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	if (thread_.joinable())
+		thread_.join();
+}
+
+std::shared_ptr<const DetectorModel> ModelWatcher::model() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return model_;
+}
+
+/*!
+* Loads a new model from the watched files. Loading happens outside of the lock, so model() does not wait for it,
+* but two reloads never run at the same time.
+* @return true if the model was reloaded
+*/
+bool ModelWatcher::reload()
+{
+	std::lock_guard<std::mutex> reloadLock(reloadMutex_);
+
+	std::shared_ptr<const DetectorModel> model;
+	std::string error;
+	try
+	{
+		model = std::make_shared<const DetectorModel>(configFile_, classifiersFolder_);
+	}
+	catch (std::exception& err)
+	{
+		error = err.what();
+	}
+	catch (...)
+	{
+		error = "unknown error loading " + configFile_;
+	}
+
+	if (model)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		model_ = model;
+		stamps_ = stampFiles(model->params());
+	}
+	if (onReload_)
+		onReload_(model, error);
+	return (model != nullptr);
+}
+
+/*!
+* Stamps the configuration file and the classifier files named by the parameters of a model.
+* @param[in] params parameters of the model
+* @return the stamps, in a fixed order
+*/
+std::vector<ModelWatcher::FileStamp> ModelWatcher::stampFiles(const DetectionParams& params) const
+{
+	std::vector<std::string> fileNames = { configFile_, params.cascadeFile, params.svmModelFile };
+	if (params.useThreeStages())
+		fileNames.push_back(params.svmModelFile2);
+	if (!params.maskFile.empty())
+		fileNames.push_back(params.maskFile);
+
+	std::vector<FileStamp> stamps;
+	for (const auto& fileName : fileNames)
+	{
+		struct stat st;
+		if (0 == stat(fileName.c_str(), &st))
+			stamps.push_back({ fileName, (long long)st.st_mtime, (long long)st.st_size });
+		else
+			stamps.push_back({ fileName, 0, -1 });
+	}
+	return stamps;
+}
+
+void ModelWatcher::watchLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (!cv_.wait_for(lock, std::chrono::milliseconds(periodMs_), [this](){ return stop_; }))
+	{
+		if (!model_)
+			continue;
+		const std::shared_ptr<const DetectorModel> model = model_;
+		const std::vector<FileStamp> previous = stamps_;
+		lock.unlock();
+		const std::vector<FileStamp> current = stampFiles(model->params());
+		bool hasChanged = false;
+		for (std::size_t i = 0; i < current.size(); ++i)
+		{
+			hasChanged = hasChanged || (current[i].mtime != previous[i].mtime) || (current[i].size != previous[i].size);
+		}
+		if (hasChanged && !reload())
+		{
+			//keep the previous model, and wait for the files to change again rather than retrying on every poll
+			std::lock_guard<std::mutex> stampLock(mutex_);
+			stamps_ = current;
+		}
+		lock.lock();
+	}
+}
@@ -18,175 +18,41 @@ Author: Giovanni Fusco - giofusco@ski.org & Ender Tekin
 */
 
 #include "ObjDetector.h"
+#include "DetectionAssociation.h"
 #include "MedianFlowTracker.hpp"
-#include "svm.h"
-#include <opencv2/objdetect/objdetect.hpp>
+#include "ThreadPool.h"
 #include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <thread>
 
-/// @class ObjDetector::CascadeDetector
-/// cascade detector using lbp features, used as first stage detector
-class ObjDetector::CascadeDetector
+namespace
 {
-public:
-
-	/// Ctor
-	/// @param[in] cascadeFileName name of file to load the cascade from
-	/// @param[in] minWinSize minimum size of the scanning window
-	/// @param[in] maxWinSize maximum size of the scanning window
-	/// @param[in] scaleFactor scale factor to use for multi-scale detection
-	/// @throw std::runtime_error if unable to allocate memory of read the cascade file
-	CascadeDetector(const std::string& cascadeFileName, const cv::Size& minWinSize, const cv::Size& maxWinSize, float scaleFactor) throw (std::runtime_error) :
-		minSz_(minWinSize),
-		maxSz_(maxWinSize),
-		scaleFactor_(scaleFactor),
-		cascade_(cascadeFileName)
-	{
-		// check that cascade detector was loaded successfully
-		if (cascade_.empty())
-		{
-			throw std::runtime_error("CascadeDetector :: Unable to load cascade detector from file " + cascadeFileName);
-		}
-	}
-
-	/// Dtor
-	~CascadeDetector() = default;
-
-	/*!
-	 * First stage of cascade classifier
-	 * @param[in] frame frame to process
-	 * @return a vector of detections candidates
-	 */
-	std::vector<cv::Rect> detect(const cv::Mat& frame) const
-	{
-		std::vector<cv::Rect> rois;
-		cascade_.detectMultiScale(frame, rois, scaleFactor_, 0, 0, minSz_, maxSz_);
-		groupRectangles(rois, 1);
-		return rois;
-	}
+	static const float VELOCITY_SMOOTHING = .5f;		//< weight of the newest measurement in the velocity estimate
+	static const float MAX_CONFIDENT_RESIDUAL = 2.f;	//< max prediction error (pixels) in the last frame for the prediction to be trusted
+	static const int MIN_CONFIDENT_SAMPLES = 2;			//< min number of tracked frames before the prediction is trusted
+	static const float TRACK_WINDOW_MARGIN = .5f;		//< margin around a tracked object scanned in its window, relative to its size
 
-	/*!
-	* First stage of cascade classifier without grouping, overrides the min & max windows size
-	* @param[in] frame frame to process
-	* @return a vector of detections candidates
-	*/
-	std::vector<cv::Rect> detectNoGrouping(const cv::Mat& frame, float scaleFactor, cv::Size minSize, cv::Size maxSize) const
+	inline cv::Point2f center(const cv::Rect& r)
 	{
-		std::vector<cv::Rect> rois;
-		cascade_.detectMultiScale(frame, rois, scaleFactor, 0, 0, minSize, maxSize);
-		return rois;
+		return cv::Point2f(r.x + .5f * r.width, r.y + .5f * r.height);
 	}
 
-	/*!
-	* First stage of cascade classifier
-	* @param[in] frame frame to process
-	* @param[in] scale factor for multiscale detection
-	* @return a vector of detections candidates
-	*/
-	std::vector<cv::Rect> detect(const cv::Mat& frame, float scaleFactor) const
+	/// @return the size of the pixel data of an image, in bytes
+	inline std::size_t imageBytes(const cv::Mat& image)
 	{
-		std::vector<cv::Rect> rois;
-		cascade_.detectMultiScale(frame, rois, scaleFactor, 0, 0, minSz_, maxSz_);
-		groupRectangles(rois, 1);
-		return rois;
-	}
-	
-	/*!
-	* First stage of cascade classifier, overrides the default min & max search windows sizes
-	* @param[in] frame frame to process
-	* @param[in] scale factor for multiscale detection
-	* @return a vector of detections candidates
-	*/
-	std::vector<cv::Rect> detect(const cv::Mat& frame, float scaleFactor, cv::Size minSize, cv::Size maxSize) const
-	{
-		std::vector<cv::Rect> rois;
-		cascade_.detectMultiScale(frame, rois, scaleFactor, 0, 0, minSize, maxSize);
-		groupRectangles(rois, 1);
-		return rois;
-	}
-private:
-	const cv::Size minSz_;  //< min win size
-	const cv::Size maxSz_;  //< max win size
-	const float scaleFactor_;     //< scale factor
-	mutable cv::CascadeClassifier cascade_;		//< cascade classifier, mutable since cv::CascadeClassifier::detectMultiScale is not const, but does not change internal state of ObjDetector
-};  // ObjDetector::CascadeDetector
-
-
-/// @class ObjDetector::SVMClassifier
-/// svm detector using HoG features, used as second stage classifier
-class ObjDetector::SVMClassifier
-{
-public:
-	/// Ctor
-	/// @param[in] svmModelFileName name of file to load the svm model from
-	/// @param[in] hogWinSize size of the window to calculate HoG
-	/// @throw std::runtime_error if unable to allocate memory of read the cascade file
-	SVMClassifier(const std::string& svmModelFileName, const cv::Size& hogWinSize) throw (std::runtime_error) :
-		hogWinSz_(hogWinSize),
-		pModel_(svm_load_model(svmModelFileName.c_str())),
-		hog_(hogWinSize,            //winSize
-		cv::Size(16, 16),       //blockSize
-		cv::Size(4, 4),         //blockStride
-		cv::Size(8, 8),         //cellSize
-		9,                     //nbins
-		1,                     //derivAperture
-		-1,                    //winSigma,
-		cv::HOGDescriptor::L2Hys,  //histogramNormType,
-		.2,                    //L2HysThreshold,
-		true,                  //gammaCorrection
-		1                      //nLevels
-		)
-	{
-		//check that svm model was loaded successfully
-		if (!pModel_)
-		{
-			throw std::runtime_error("SVMDetector :: Unable to load svm model from file " + svmModelFileName);
-		}
+		return image.total() * image.elemSize();
 	}
 
-	/// Dtor
-	~SVMClassifier() = default;
-
-	/*!
-	 * Verifies the ROIs detected in the first stage using SVM + HOG
-	 * @param[in] patch patch to classify
-	 * @return a pair of values indicating the estimated class and confidence of the patch.
-	 * @throw runtime error if unable to allocate memory for this stage
-	 */
-	std::pair<int, double> classify(const cv::Mat& patch) const
+	/// @return true if the plan scans the whole frame with the configured settings, so that its results can be reused
+	inline bool isFullScan(const LatencyController::Plan& plan, const DetectionParams& params)
 	{
-		std::vector<ObjDetector::DetectionInfo> result;
-		double prob_est[2];
-
-		//TODO: The index is set from scratch for each patch. If descriptor sizes are the same for each window, the next two can be optimized by setting it once as member variables
-		std::vector<float> desc;
-		std::vector<svm_node> x;
-
-		cv::Mat resized(hogWinSz_, CV_32FC1);
-
-		//use svm to classify the patch
-		cv::resize(patch, resized, hogWinSz_);
-		hog_.compute(resized, desc);
-		x.resize(desc.size() + 1);
-
-		for (int d = 0; d < desc.size(); d++){
-			x[d].index = d + 1;  // Index starts from 1; Pre-computed kernel starts from 0
-			x[d].value = desc[d];
-		}
-
-		x[desc.size()].index = -1;
-		desc.clear();
-
-		int label = round(svm_predict_probability(pModel_.get(), x.data(), prob_est));
-		return std::make_pair(label, prob_est[label < 0]);
+		return plan.doScan && !plan.scanTracksOnly && (plan.scaleFactor == params.cascadeScaleFactor) &&
+			(plan.minWin == params.cascadeMinWin) && (plan.maxWin == params.cascadeMaxWin);
 	}
-private:
-	const cv::Size hogWinSz_;                   //< min win size
-	const std::unique_ptr<svm_model> pModel_;   //< svm model
-	const cv::HOGDescriptor hog_;				//< hog feature extractor
-};  // ObjDetector::SVMDetector
-
-
+}   //::<anon>
 
 //===========================
 //
@@ -195,51 +61,123 @@ private:
 //===========================
 
 ObjDetector::ObjDetector() :
-init_(false),
-params_()
+model_(nullptr),
+nextModel_(nullptr)
 {
 }
 
 ObjDetector::ObjDetector(const std::string& yamlConfigFile, const std::string& classifiersFolder) throw(std::runtime_error) :
-init_(false),
-pCascadeDetector(nullptr),
-pSVMClassifier(nullptr),
-params_(yamlConfigFile, classifiersFolder)
+model_(std::make_shared<const DetectorModel>(yamlConfigFile, classifiersFolder)),
+nextModel_(model_)
+{
+	init();
+}
+
+ObjDetector::ObjDetector(std::shared_ptr<const DetectorModel> model) throw(std::runtime_error) :
+model_(model),
+nextModel_(model)
 {
+	if (!model_)
+	{
+		throw std::runtime_error("OBJDETECTOR ERROR :: No model given");
+	}
 	init();
 }
 
 void ObjDetector::init(const std::string& yamlConfigFile, const std::string& classifiersFolder) throw (std::runtime_error)
 {
-	params_.loadFromFile(yamlConfigFile, classifiersFolder);
+	auto model = std::make_shared<const DetectorModel>(yamlConfigFile, classifiersFolder);
+	waitForPending();
+	model_ = model;
+	std::atomic_store(&nextModel_, model_);
 	init();
 };
 
-ObjDetector::~ObjDetector() = default;
-
 /*!
-* initializes the classifiers and the HOG feature extractor.
-* @exception std::runtime_error error loading one of the classfiers
+* Replaces the model from the next frame on. The tracked objects and the counters are kept.
+* This can be called from any thread, while frames are being processed: a frame uses a single model throughout,
+* the one current when its processing starts. Only nextModel_ is touched then, atomically; model_ belongs to the second stage.
+* A detector that is not initialized yet is initialized with the model instead, which must not overlap other calls on it.
+* @param[in] model new model
+* @exception runtime_error if model is null
 */
-void ObjDetector::init() throw(std::runtime_error)
+void ObjDetector::setModel(std::shared_ptr<const DetectorModel> model) throw (std::runtime_error)
 {
-	counter_ = 0;
-	try
+	if (!model)
 	{
-		pCascadeDetector = std::unique_ptr<CascadeDetector>(new CascadeDetector(params_.cascadeFile, params_.cascadeMinWin, params_.cascadeMaxWin, params_.cascadeScaleFactor));
-		pSVMClassifier = std::unique_ptr<SVMClassifier>(new SVMClassifier(params_.svmModelFile, params_.hogWinSize));
-		if (params_.useThreeStages()){
-			pSVMClassifier2 = std::unique_ptr<SVMClassifier>(new SVMClassifier(params_.svmModelFile2, params_.hogWinSize));
-		}
-
+		throw std::runtime_error("OBJDETECTOR ERROR :: No model given");
 	}
-	catch (std::exception& err)
+	if (!std::atomic_load(&nextModel_))	//not initialized yet: detect() and detectAsync() refuse frames, so none is in flight
 	{
-		throw std::runtime_error(std::string("OBJDETECTOR ERROR :: ") + err.what());
+		model_ = model;
+		std::atomic_store(&nextModel_, model);
+		init();
+		return;
 	}
+	std::atomic_store(&nextModel_, model);
+}
 
-	if (pCascadeDetector && pSVMClassifier) //this should be an assertion since we previosuly catch errors
-		init_ = true;
+/*!
+* Makes the model of the frame entering the second stage current, and adapts the resources of the stream to its
+* parameters. Called from the second stage only, so no frame is using the previous model's state anymore.
+* @param[in] model model the frame was first processed with
+*/
+void ObjDetector::adoptModel(std::shared_ptr<const DetectorModel> model)
+{
+	model_ = model;
+	configureTracking();
+	resultCache_.configure(params().resultCacheSize, params().resultCacheMaxDistance, params().resultCacheMaxReuse);
+}
+
+/*!
+* Waits until the frames queued by detectAsync() are processed, so that the state of the stream can be used or reset.
+*/
+void ObjDetector::waitForPending()
+{
+	if (pSecondStageWorker_)	//the second stages run in order, so a no-op queued now runs after all of them
+	{
+		pSecondStageWorker_->submit([](){}).get();
+	}
+}
+
+ObjDetector::~ObjDetector() = default;
+
+/*!
+* resets the state of the stream, and sets up the resources it needs according to the model parameters.
+*/
+void ObjDetector::init()
+{
+	waitForPending();
+	counter_ = 0;
+	verificationStats_ = { 0, 0 };
+	stats_ = DetectionStats();
+	latencyController_ = LatencyController(params().frameDeadline, params().maxDegradationLevel);
+	secondStageOutputs_.clear();
+	rois_.clear();
+	prevFrame_.release();
+	grayFrame_.release();
+	bytesCopied_ = 0;
+	framePool_.clear();
+	resultCache_.configure(params().resultCacheSize, params().resultCacheMaxDistance, params().resultCacheMaxReuse);
+	hasPrevHash_ = false;
+	scanHistory_ = ScanHistory();
+	configureTracking();
+}
+
+/*!
+* sets up the workers updating the tracked objects according to the model parameters, if they differ from the current ones.
+*/
+void ObjDetector::configureTracking()
+{
+	//the calling thread takes part in the tracking, so the pool only needs the remaining threads
+	const unsigned int nThreads = (params().nTrackingThreads > 0 ? params().nTrackingThreads : std::max(1u, std::thread::hardware_concurrency()));
+	const std::size_t nWorkers = (pTrackingPool_ ? pTrackingPool_->size() : 0);
+	if (nWorkers + 1 == nThreads)
+		return;
+	if (nThreads > 1)
+		pTrackingPool_ = std::unique_ptr<ThreadPool>(new ThreadPool(nThreads - 1));
+	else
+		pTrackingPool_.reset();
 }
 
 /*!
@@ -253,14 +191,12 @@ void ObjDetector::init() throw(std::runtime_error)
 std::vector<ObjDetector::DetectionInfo> ObjDetector::detect(cv::Mat& frame, double& FPS, bool doTrack) throw (std::runtime_error)
 {
 	//measure delta_T
-	time_t end;
 	if (counter_ == 0)
-		time(&start_);
+		start_ = std::chrono::steady_clock::now();
 	auto result = detect(frame, doTrack);
-	time(&end);
 	counter_++;
-	double sec = difftime(end, start_);
-	FPS = counter_ / sec;
+	const double ms = elapsedMilliseconds(start_);
+	FPS = (ms > 0. ? 1000. * counter_ / ms : 0.);
 	return result;
 }
 
@@ -269,187 +205,656 @@ std::vector<ObjDetector::DetectionInfo> ObjDetector::detect(cv::Mat& frame, doub
 * @param[in] frame
 * @return a vector of DetectionInfo containing information about the detections
 * @exception runtime_error if the detector is not properly initialized
-* @TODO: bring out the refinement step parameter
 */
 std::vector<ObjDetector::DetectionInfo> ObjDetector::detect(cv::Mat& frame, bool doTrack) throw (std::runtime_error)
 {
-	if (!params_.isInit())
+	if (!std::atomic_load(&nextModel_))
 	{
-		throw std::runtime_error("OBJDETECTOR :: Parameters not initialized");
+		throw std::runtime_error("OBJDETECTOR :: Detector not initialized");
 	}
-	if (!init_)
+	waitForPending();	//frames are processed in order, and model_ is not being replaced by a queued frame anymore
+	assert(params().isInit());
+
+	FrameState state;
+	runFirstStage(frame, state);
+	frame = state.frame;	//the caller gets the rescaled frame
+	return runSecondStage(state, doTrack);
+}
+
+/*!
+* Queues a frame for detection. The first stage of a frame runs on one worker while the second stage of the previous
+* frame runs on another, and the second stages run in submission order, so the tracked objects are updated exactly as
+* with detect().
+* @param[in] frame input image. Its pixels are shared, not copied, and must not change until the result is ready.
+* @param[in] doTrack if true, use tracking, otherwise detection is independent between frames.
+* @return the detections, available once the frame and all the frames queued before it are processed
+* @exception runtime_error if the detector is not properly initialized. Errors during the detection are reported through the future.
+*/
+std::future<std::vector<ObjDetector::DetectionInfo>> ObjDetector::detectAsync(const cv::Mat& frame, bool doTrack) throw (std::runtime_error)
+{
+	if (!std::atomic_load(&nextModel_))	//model_ may be assigned by the second stage of a queued frame
 	{
 		throw std::runtime_error("OBJDETECTOR :: Detector not initialized");
 	}
-	assert(pCascadeDetector && pSVMClassifier);
+	if (!pFirstStageWorker_)
+	{
+		pFirstStageWorker_ = std::unique_ptr<ThreadPool>(new ThreadPool(1));
+		pSecondStageWorker_ = std::unique_ptr<ThreadPool>(new ThreadPool(1));
+	}
 
-	if (params_.scalingFactor != 1 && params_.scalingFactor > 0)
-		resize(frame, frame, cv::Size(), params_.scalingFactor, params_.scalingFactor);
+	auto pState = std::make_shared<FrameState>();
+	std::shared_future<void> firstStage = pFirstStageWorker_->submit([this, frame, pState]()
+	{
+		runFirstStage(frame, *pState);
+	}).share();
+	return pSecondStageWorker_->submit([this, firstStage, pState, doTrack]()
+	{
+		firstStage.get();	//rethrows the errors of the first stage
+		return runSecondStage(*pState, doTrack);
+	});
+}
 
-	frame.copyTo(currFrame);
+/*!
+* First stage of a frame: rescaling, cropping and cascade detection. It only reads the model and the latency controller,
+* so it can run while the second stage of the previous frame updates the tracked objects.
+* When the cascade only scans around the tracked objects, it is left to the second stage, once these objects are known.
+* If the result cache is on and holds the view, the cascade is skipped, and so is the SVM in the second stage.
+* @param[in] frame input image
+* @param[out] state rescaled and cropped frame, and the first stage results
+*/
+void ObjDetector::runFirstStage(const cv::Mat& frame, FrameState& state) const
+{
+	const auto startTime = std::chrono::steady_clock::now();
+	state.model = std::atomic_load(&nextModel_);	//snapshot, used by both stages of the frame
+	const DetectionParams& params = state.model->params();
+	{
+		std::lock_guard<std::mutex> lock(latencyMutex_);
+		state.plan = latencyController_.plan(params);
+	}
+
+	state.bytesCopied = 0;
+	state.frame = frame;	//shares the pixels of frame, no copy
+	if (params.scalingFactor != 1 && params.scalingFactor > 0)
+	{
+		const cv::Size size(cvRound(frame.cols * params.scalingFactor), cvRound(frame.rows * params.scalingFactor));
+		cv::Mat resized = framePool_.acquire(size, frame.type());	//recycled buffer, cv::resize keeps it as the size and type match
+		resize(frame, resized, size);
+		state.frame = resized;
+		state.bytesCopied += imageBytes(resized);
+	}
 	//cropping
-	cropped_ = frame(cv::Rect(0, 0, frame.size().width * params_.croppingFactors[0], frame.size().height*params_.croppingFactors[1]));
+	state.cropped = state.frame(cv::Rect(0, 0, state.frame.size().width * params.croppingFactors[0], state.frame.size().height*params.croppingFactors[1]));
+	state.mask = state.model->regionMask(state.frame.size());	//rendered once per frame size
+	if (!state.mask.empty())
+		state.mask = state.mask(cv::Rect(0, 0, state.cropped.cols, state.cropped.rows));
+	state.hasHash = (params.resultCacheSize > 0);
+	state.isCacheHit = false;
+	if (state.hasHash)
+	{
+		state.hash = ResultCache::hashImage(state.cropped);
+		state.isCacheHit = resultCache_.find(state.model, state.cropped.size(), state.hash, state.cached);
+	}
+	state.preprocessingTime = elapsedMilliseconds(startTime);
+
+	state.hasCandidates = state.isCacheHit || !state.plan.scanTracksOnly;
+	state.cascadeTime = 0.;
+	state.nBlocks = 0;
+	state.nDirtyBlocks = 0;
+	if (state.hasCandidates && !state.isCacheHit)
+	{
+		const auto stageStart = std::chrono::steady_clock::now();
+		if (params.incrementalScan && state.plan.doScan)
+			state.candidates = scanIncrementally(state);
+		else
+			state.candidates = scanCandidates(*state.model, state.cropped, state.mask, state.plan);
+		state.cascadeTime = elapsedMilliseconds(stageStart);
+	}
+	state.firstStageTime = elapsedMilliseconds(startTime);
+}
+
+/*!
+* Moves the first stage outputs of a frame to rois_, running the cascade first if the first stage left it to this stage.
+* @param[in,out] state frame state. Its candidates are moved out.
+*/
+void ObjDetector::collectCandidates(FrameState& state)
+{
+	if (!state.hasCandidates)
+	{
+		const auto stageStart = std::chrono::steady_clock::now();
+		state.candidates = scanCandidates(*model_, cropped_, mask_, state.plan);
+		state.cascadeTime = elapsedMilliseconds(stageStart);
+	}
+	rois_.swap(state.candidates);
+	stats_.latencies[DetectionStats::CASCADE].add(state.cascadeTime);
+	if (state.nBlocks > 0)
+	{
+		++stats_.nPartialScans;
+		stats_.nBlocks += state.nBlocks;
+		stats_.nDirtyBlocks += state.nDirtyBlocks;
+	}
+}
+
+/*!
+* Verifies the first stage outputs of a frame with the SVM. If the result cache holds the view, its verdicts are used instead,
+* and rois_ is left empty since the cascade did not run. The verdicts of full scans are stored in the cache.
+* @param[in,out] state frame state. Its candidates are moved out.
+* @return the candidates confirmed by the SVM
+*/
+std::vector<ObjDetector::DetectionInfo> ObjDetector::verifyCandidates(FrameState& state)
+{
+	std::vector<DetectionInfo> detections;
+	if (state.isCacheHit)
+	{
+		++stats_.nCacheHits;
+		rois_.clear();
+		for (std::size_t i = 0; i < state.cached.rois.size(); ++i)
+		{
+			detections.push_back({ state.cached.rois[i], state.cached.confidences[i], 0, std::string(), 0 });
+		}
+		return detections;
+	}
+
+	collectCandidates(state);
+	const auto stageStart = std::chrono::steady_clock::now();
+	for (const auto& det : rois_)
+	{
+		auto res = model_->classify(cropped_(det));
+		if ((1 == res.first) && (res.second > params().SVMThreshold)) //svm confirms detection
+		{
+			detections.push_back({ det, res.second, 0, std::string(), 0 });
+		}
+	}
+	stats_.latencies[DetectionStats::STAGE2].add(elapsedMilliseconds(stageStart));
+	stats_.nAccepted += detections.size();
+	stats_.nRejected += rois_.size() - detections.size();
+
+	if (state.hasHash)
+	{
+		++stats_.nCacheMisses;
+		if (isFullScan(state.plan, params()))	//reduced scans would lower the quality of the later frames of the view
+		{
+			ResultCache::Result result;
+			for (const auto& det : detections)
+			{
+				result.rois.push_back(det.roi);
+				result.confidences.push_back(det.confidence);
+			}
+			resultCache_.insert(model_, cropped_.size(), state.hash, result);
+		}
+	}
+	return detections;
+}
+
+/*!
+* Second stage of a frame: tracking, SVM verification, association with the tracked objects and third stage.
+* This is the only part of the detection that updates the state of the stream, so it runs one frame at a time, in order.
+* @param[in,out] state output of the first stage of the frame
+* @param[in] doTrack if true, use tracking, otherwise detection is independent between frames.
+* @return the detections
+*/
+std::vector<ObjDetector::DetectionInfo> ObjDetector::runSecondStage(FrameState& state, bool doTrack)
+{
+	const auto startTime = std::chrono::steady_clock::now();
+	auto stageStart = startTime;
+	if (state.model != model_)
+	{
+		adoptModel(state.model);
+	}
+	bytesCopied_ = state.bytesCopied;
+	currFrame = state.frame;	//shares the pixels of the frame, no copy
+	cropped_ = state.cropped;
+	mask_ = state.mask;
+	double preprocessingTime = state.preprocessingTime;
 
 	std::vector<DetectionInfo> result;
 
 	//with or without tracking
 	if (doTrack)    //with tracking
 	{
-		cv::Mat_<std::uint8_t> grayFrame;
+		bool isGrayFrameValid = false;	//whether grayFrame_ holds the current frame
+		//same view as prevFrame_: the objects have not moved, so neither the tracker nor a new grayscale frame is needed
+		const bool isStaticView = state.hasHash && hasPrevHash_ && (prevFrame_.size() == cropped_.size()) && resultCache_.isSameView(state.hash, prevHash_);
 		// track all objects that were previously detected
 		if (!secondStageOutputs_.empty()) //objects being tracked
 		{
-			
-			cv::cvtColor(cropped_, grayFrame, CV_BGR2GRAY);
-			for (auto it = secondStageOutputs_.begin(); it != secondStageOutputs_.end();)
+			stageStart = std::chrono::steady_clock::now();
+			if (!isStaticView)
 			{
-				it->roi = trackMedianFlow(it->roi, prevFrame_, grayFrame);
-				if (0 == it->roi.area())    //tracker lost object
+				cv::cvtColor(cropped_, grayFrame_, CV_BGR2GRAY);
+				isGrayFrameValid = true;
+			}
+			preprocessingTime += elapsedMilliseconds(stageStart);
+
+			stageStart = std::chrono::steady_clock::now();
+
+			// tracks are independent, so track and verify them concurrently, writing each result in its own slot
+			const std::size_t nTracks = secondStageOutputs_.size();
+			std::vector<cv::Rect> trackedRois(nTracks);
+			std::vector<std::pair<int, double>> verifications(nTracks);
+			std::vector<char> isVerified(nTracks, false);
+			auto updateTrack = [&](std::size_t i)
+			{
+				MedianFlowQuality quality = { 0.f, 1.f, 1.f };	//perfect fit of a static view
+				if (isStaticView)
+				{
+					trackedRois[i] = secondStageOutputs_.rois[i];
+				}
+				else
+				{
+					MedianFlowPrior prior = { cv::Point2f(0.f, 0.f), false };
+					if (params().useMotionPrediction)
+					{
+						prior.motion = secondStageOutputs_.velocities[i];
+						prior.isConfident = (secondStageOutputs_.nMotionSamples[i] >= MIN_CONFIDENT_SAMPLES) && (secondStageOutputs_.motionResiduals[i] < MAX_CONFIDENT_RESIDUAL);
+					}
+					trackedRois[i] = trackMedianFlow(secondStageOutputs_.rois[i], prevFrame_, grayFrame_, prior, quality);
+				}
+				if ((trackedRois[i].area() > 0) && !DetectorModel::isSearched(mask_, trackedRois[i]))
+					trackedRois[i] = cv::Rect();	//moved into a masked region, dropped like a lost object
+				if (trackedRois[i].area() > 0)
 				{
-					it = secondStageOutputs_.erase(it);
+					if (!needsVerification(i, quality))
+						return;
+					// attempt to confirm detections via svm.
+					verifications[i] = model_->classify(cropped_(trackedRois[i]));  //TODO: If SVM is using grayscale, we should just pass it the grayscale image to reduce computation
+					isVerified[i] = true;
+				}
+			};
+			if (pTrackingPool_)
+			{
+				pTrackingPool_->parallelFor(nTracks, updateTrack);
+			}
+			else
+			{
+				for (std::size_t i = 0; i < nTracks; ++i)
+					updateTrack(i);
+			}
+
+			// commit the results serially, in slot order
+			for (std::size_t i = 0; i < nTracks; ++i)
+			{
+				if (trackedRois[i].area() > 0)	//update the constant velocity model
+				{
+					const cv::Point2f motion = center(trackedRois[i]) - center(secondStageOutputs_.rois[i]);
+					cv::Point2f& velocity = secondStageOutputs_.velocities[i];
+					secondStageOutputs_.motionResiduals[i] = cv::norm(motion - velocity);
+					velocity = (0 == secondStageOutputs_.nMotionSamples[i] ? motion : velocity + VELOCITY_SMOOTHING * (motion - velocity));
+					++secondStageOutputs_.nMotionSamples[i];
+				}
+				secondStageOutputs_.rois[i] = trackedRois[i];
+				if (0 == trackedRois[i].area())
+					continue;
+				if (!isVerified[i])	//reliable fit on a confirmed object, keep the last verdict
+				{
+					++secondStageOutputs_.nFramesSinceVerification[i];
+					++verificationStats_.nSkipped;
 					continue;
 				}
-				// attempt to confirm detections via svm.
-				auto res = pSVMClassifier->classify(cropped_(it->roi));  //TODO: If SVM is using grayscale, we should just pass it the grayscale image to reduce computation
-				it->confidence = res.second;
-				if ((1 == res.first) && (res.second > params_.SVMThreshold)) //svm confirms detection
+				++verificationStats_.nRun;
+				secondStageOutputs_.nFramesSinceVerification[i] = 0;
+				const auto& res = verifications[i];
+				secondStageOutputs_.confidences[i] = res.second;
+				if ((1 == res.first) && (res.second > params().SVMThreshold)) //svm confirms detection
 				{
-					
-					it->age = 0;
+					secondStageOutputs_.ages[i] = 0;
 				}
 				else    //svm did not classify patch as foreground
 				{
-					++it->age;   //increase age
+					++secondStageOutputs_.ages[i];   //increase age
 				}
-				++it;
 			}
-		}
-
-		// Run cascade detector
-		rois_ = pCascadeDetector->detect(cropped_);
-		std::vector<DetectionInfo> newDetections;
-		for (const auto& det : rois_)
-		{
-			auto res = pSVMClassifier->classify(cropped_(det));
-			if ((1 == res.first) && (res.second > params_.SVMThreshold)) //svm confirms detection
+			for (std::size_t i = 0; i < secondStageOutputs_.size();)
 			{
-				newDetections.push_back({ det, res.second });
+				if (0 == secondStageOutputs_.rois[i].area())    //tracker lost object
+				{
+					secondStageOutputs_.remove(i);
+					continue;
+				}
+				++i;
 			}
+			stats_.latencies[DetectionStats::TRACKING].add(elapsedMilliseconds(stageStart));
 		}
+
+		// Run cascade detector
+		const std::vector<DetectionInfo> newDetections = verifyCandidates(state);
 		
 		// Combine detections
-		auto overlaps = [](const cv::Rect& r1, const cv::Rect& r2){return ((r1 & r2).area() > .5 * std::min(r1.area(), r2.area())); };   //two rectangles overlap if their intersection is greater than half the smaller
-		
-		for (auto& obj : secondStageOutputs_)
+		stageStart = std::chrono::steady_clock::now();
+		std::vector<cv::Rect> newRois;
+		newRois.reserve(newDetections.size());
+		for (const auto& det : newDetections)
 		{
-			for (auto itDet = newDetections.begin(); itDet != newDetections.end();)
+			newRois.push_back(det.roi);
+		}
+		const auto association = associateDetections(secondStageOutputs_.rois, newRois);
+		for (std::size_t j = 0; j < newDetections.size(); ++j)
+		{
+			const int i = association.detectionToTrack[j];
+			if (i < 0)
+				continue;
+			// assigned detections and duplicates both confirm the track, only the assigned one can move it
+			secondStageOutputs_.ages[i] = 0;
+			secondStageOutputs_.nFramesSinceVerification[i] = 0;
+			if ((association.trackToDetection[i] == (int)j) && (newDetections[j].confidence > secondStageOutputs_.confidences[i]))
 			{
-				if (overlaps(obj.roi, itDet->roi))
-				{
-					obj.age = 0;
-					if (itDet->confidence > obj.confidence)
-					{
-						obj.confidence = itDet->confidence;
-						obj.roi = itDet->roi;
-					}
-					itDet = newDetections.erase(itDet);
-					continue;
-				}
-				++itDet;
+				secondStageOutputs_.confidences[i] = newDetections[j].confidence;
+				secondStageOutputs_.rois[i] = newDetections[j].roi;
 			}
 		}
 		//std::cerr << "combine\n";
 
 		// prune old detections, update the number oftimes new detections have been seen
-		for (auto it = secondStageOutputs_.begin(); it != secondStageOutputs_.end();)
+		for (std::size_t i = 0; i < secondStageOutputs_.size();)
 		{
-			if (0 == it->age)
+			if (0 == secondStageOutputs_.ages[i])
 			{
-				++(it->nTimesSeen);
+				++secondStageOutputs_.nTimesSeen[i];
 			}
 			else
 			{
-				int maxAge = (it->nTimesSeen < params_.nHangOverFrames ? params_.maxAgePreConfirmation : params_.maxAgePostConfirmation);
-				if (it->age > maxAge)
+				int maxAge = (secondStageOutputs_.nTimesSeen[i] < params().nHangOverFrames ? params().maxAgePreConfirmation : params().maxAgePostConfirmation);
+				if (secondStageOutputs_.ages[i] > maxAge)
 				{
-					it = secondStageOutputs_.erase(it);
+					secondStageOutputs_.remove(i);
 					continue;
 				}
 			}
-			++it;
+			++i;
 		}
 
 		//get confirmed detections
-		for (const auto& obj : secondStageOutputs_)
+		for (std::size_t i = 0; i < secondStageOutputs_.size(); ++i)
 		{
-			if (obj.nTimesSeen > params_.nHangOverFrames)
+			if (secondStageOutputs_.nTimesSeen[i] > params().nHangOverFrames)
 			{
-				result.push_back({ obj.roi, obj.confidence, 0 });
+				result.push_back({ secondStageOutputs_.rois[i], secondStageOutputs_.confidences[i], 0, std::string(), secondStageOutputs_.ids[i] });
 			}
 		}
 		//std::cerr << "confirmed\n";
 
 		// add unmatched new detections
-		for (const auto& det : newDetections)
+		for (std::size_t j = 0; j < newDetections.size(); ++j)
 		{
-			secondStageOutputs_.push_back({ det.roi, det.confidence, 0, 1 });
+			if (association.detectionToTrack[j] < 0)
+			{
+				secondStageOutputs_.add(newDetections[j].roi, newDetections[j].confidence);
+			}
 		}
 
-		//sort results in order of decreasing confidence (most confident first)
-		std::sort(result.begin(), result.end(), [](const DetectionInfo& res1, const DetectionInfo& res2){return res1.confidence > res2.confidence; });
-
-		if (!secondStageOutputs_.empty())   //we are tracking some objects, so save the grayscale image for next time
+		if (!secondStageOutputs_.empty() && !isStaticView)   //we are tracking some objects, so save the grayscale image for next time. A static view is already there.
 		{
-			if (grayFrame.empty())  //no objects were tracked before
+			if (!isGrayFrameValid)  //no objects were tracked before
 			{
 				cv::cvtColor(cropped_, prevFrame_, CV_BGR2GRAY);
 			}
 			else
 			{
-				prevFrame_ = grayFrame.clone();
+				//keep the current frame, and recycle the buffer of the previous one for the next conversion
+				cv::swap(prevFrame_, grayFrame_);
 			}
+			hasPrevHash_ = state.hasHash;
+			prevHash_ = state.hash;
 		}
+		stats_.latencies[DetectionStats::ASSOCIATION].add(elapsedMilliseconds(stageStart));
+		stats_.nTrackFrames += secondStageOutputs_.size();
+		stats_.maxActiveTracks = std::max<unsigned long>(stats_.maxActiveTracks, secondStageOutputs_.size());
 	}
 	else    //no tracking
 	{
 		// Run cascade detector
-		rois_ = pCascadeDetector->detect(cropped_);
-		for (const auto& det : rois_)
-		{
-			auto res = pSVMClassifier->classify(cropped_(det));
-			if ((1 == res.first) && (res.second > params_.SVMThreshold)) //svm confirms detection
-			{
-				result.push_back({ det, res.second, 0 });
-			}
-		}
+		result = verifyCandidates(state);
 	}
+	stats_.latencies[DetectionStats::PREPROCESSING].add(preprocessingTime);
+	stats_.nCandidates += rois_.size();
 
 	
 //	std::cerr << "size of filtered results: " << result.size() << std::endl;
 
+	if (params().useRefinement && !result.empty())
+	{
+		stageStart = std::chrono::steady_clock::now();
+		refineDetections(*model_, cropped_, result, pTrackingPool_.get(), stats_.nRefined, stats_.nRefinementsSkipped);
+		stats_.latencies[DetectionStats::REFINEMENT].add(elapsedMilliseconds(stageStart));
+	}
+
+	if (doTrack)	//sort results in order of decreasing confidence (most confident first), once refinement has set it
+	{
+		std::sort(result.begin(), result.end(), [](const DetectionInfo& res1, const DetectionInfo& res2){return res1.confidence > res2.confidence; });
+	}
+
 	//if has a 3rd stage, classify the ROIs
-	if (params_.useThreeStages()){
-		std::vector<DetectionInfo> result2;
-		for (const auto& det : result){
-			auto res = pSVMClassifier2->classify(cropped_(det.roi));
-			if ((1 == res.first) && (res.second > params_.SVMThreshold)) //svm labeled +1
-				result2.push_back({ det.roi, res.second, 1, params_.labels.at(1)});
-			else
-				result2.push_back({ det.roi, res.second, -1, params_.labels.at(0)});
+	if (params().useThreeStages()){
+		stageStart = std::chrono::steady_clock::now();
+		labelDetections(*model_, cropped_, result);
+		stats_.latencies[DetectionStats::STAGE3].add(elapsedMilliseconds(stageStart));
+	}
+
+	const double frameTime = state.firstStageTime + elapsedMilliseconds(startTime);	//processing time, excluding the wait between the stages
+	stats_.latencies[DetectionStats::TOTAL].add(frameTime);
+	++stats_.nFrames;
+	{
+		std::lock_guard<std::mutex> lock(latencyMutex_);
+		latencyController_.update(frameTime);
+	}
+	return result;
+}
+
+/*!
+* Labels verified detections with the third stage classifier.
+* @param[in] model model to use
+* @param[in] image image the detections are found in
+* @param[in,out] detections detections to label. Their confidence is replaced by the one of the third stage.
+*/
+void ObjDetector::labelDetections(const DetectorModel& model, const cv::Mat& image, std::vector<DetectionInfo>& detections)
+{
+	for (auto& det : detections){
+		auto res = model.classifyStage3(image(det.roi));
+		det.confidence = res.second;
+		if ((1 == res.first) && (res.second > model.params().SVMThreshold)){ //svm labeled +1
+			det.iLabel = 1;
+			det.sLabel = model.params().labels.at(1);
+		}
+		else{
+			det.iLabel = -1;
+			det.sLabel = model.params().labels.at(0);
 		}
-		return result2;
 	}
+}
 
+/*!
+* Detects objects in independent images, in parallel. No state of the detector is used or modified, so tracking
+* is off, and this can be called concurrently with detect().
+* @param[in] images images to process
+* @param[in] pool workers to use along with the calling thread. If null, the images are processed on the calling thread only.
+* @return the detections of each image, in the order of the images
+* @exception runtime_error if the detector is not properly initialized, or the processing of an image fails
+*/
+std::vector<std::vector<ObjDetector::DetectionInfo>> ObjDetector::detectBatch(const std::vector<cv::Mat>& images, ThreadPool* pool) const throw (std::runtime_error)
+{
+	const auto model = std::atomic_load(&nextModel_);	//the whole batch uses the same model
+	if (!model)
+	{
+		throw std::runtime_error("OBJDETECTOR :: Detector not initialized");
+	}
+	std::vector<std::vector<DetectionInfo>> results(images.size());
+	auto detectImage = [&](std::size_t i)
+	{
+		results[i] = detectStill(*model, images[i]);
+	};
+	if (pool)
+	{
+		pool->parallelFor(images.size(), detectImage);
+	}
 	else
+	{
+		for (std::size_t i = 0; i < images.size(); ++i)
+			detectImage(i);
+	}
+	return results;
+}
+
+/*!
+* Detects objects in a single image, without tracking and without touching the state of the detector.
+* @param[in] model model to use
+* @param[in] image image to process. It is not modified.
+* @return the detections, sorted by decreasing confidence, in the coordinates of the rescaled image
+*/
+std::vector<ObjDetector::DetectionInfo> ObjDetector::detectStill(const DetectorModel& model, const cv::Mat& image)
+{
+	std::vector<DetectionInfo> result;
+	if (image.empty())
 		return result;
+
+	const DetectionParams& params = model.params();
+	cv::Mat frame = image;
+	if (params.scalingFactor != 1 && params.scalingFactor > 0)
+	{
+		resize(image, frame, cv::Size(), params.scalingFactor, params.scalingFactor);
+	}
+	const cv::Rect croppedRect(0, 0, frame.size().width * params.croppingFactors[0], frame.size().height*params.croppingFactors[1]);
+	const cv::Mat cropped = frame(croppedRect);
+	const cv::Mat mask = model.regionMask(frame.size());
+
+	for (const auto& det : model.detectCandidates(cropped, params.cascadeScaleFactor, params.cascadeMinWin, params.cascadeMaxWin, (mask.empty() ? cv::Mat() : mask(croppedRect))))
+	{
+		auto res = model.classify(cropped(det));
+		if ((1 == res.first) && (res.second > params.SVMThreshold)) //svm confirms detection
+		{
+			result.push_back({ det, res.second, 0, std::string(), 0 });
+		}
+	}
+	if (params.useRefinement)
+	{
+		unsigned long nRefined = 0, nSkipped = 0;
+		refineDetections(model, cropped, result, nullptr, nRefined, nSkipped);
+	}
+	if (params.useThreeStages())
+	{
+		labelDetections(model, cropped, result);
+	}
+	std::sort(result.begin(), result.end(), [](const DetectionInfo& res1, const DetectionInfo& res2){return res1.confidence > res2.confidence; });
+	return result;
+}
+
+/*!
+* Sets the real-time deadline, and restarts the latency controller with the full work per frame.
+* @param[in] deadline target processing time per frame in milliseconds, 0 to disable the controller
+*/
+void ObjDetector::setDeadline(double deadline)
+{
+	const auto model = std::atomic_load(&nextModel_);
+	const int maxLevel = (model ? model->params().maxDegradationLevel : LatencyController::MAX_LEVEL);
+	std::lock_guard<std::mutex> lock(latencyMutex_);
+	latencyController_ = LatencyController(deadline, maxLevel);
+}
+
+/*!
+* Runs the cascade on the cropped frame as planned by the latency controller: on the whole frame, only around the
+* tracked objects, or not at all.
+* @param[in] model model to use
+* @param[in] image cropped frame
+* @param[in] mask region mask of image, empty if the whole image is searched
+* @param[in] plan first stage settings for the current frame
+* @return candidate ROIs, in the coordinates of the cropped frame
+*/
+std::vector<cv::Rect> ObjDetector::scanCandidates(const DetectorModel& model, const cv::Mat& image, const cv::Mat& mask, const LatencyController::Plan& plan) const
+{
+	if (!plan.doScan)
+		return std::vector<cv::Rect>();
+	if (!plan.scanTracksOnly)
+		return model.detectCandidates(image, plan.scaleFactor, plan.minWin, plan.maxWin, mask);
+
+	std::vector<cv::Rect> candidates;
+	const cv::Rect frameRect(0, 0, image.cols, image.rows);
+	for (const auto& roi : secondStageOutputs_.rois)
+	{
+		const int dx = cvRound(TRACK_WINDOW_MARGIN * roi.width);
+		const int dy = cvRound(TRACK_WINDOW_MARGIN * roi.height);
+		const cv::Rect window = cv::Rect(roi.x - dx, roi.y - dy, roi.width + 2 * dx, roi.height + 2 * dy) & frameRect;
+		if ((window.width < plan.minWin.width) || (window.height < plan.minWin.height))
+			continue;
+		for (const auto& det : model.detectCandidates(image(window), plan.scaleFactor, plan.minWin, plan.maxWin, (mask.empty() ? cv::Mat() : mask(window))))
+		{
+			candidates.push_back(det + window.tl());
+		}
+	}
+	return candidates;
+}
+
+/*!
+* Runs the cascade on the whole cropped frame, but only scans again the windows that overlap blocks that changed since the
+* previous scan: the hits of the previous scan elsewhere are kept. A block has changed when its mean absolute gray level
+* difference with the reference exceeds the threshold. The reference is only updated where blocks changed, so that slow
+* changes add up until they are noticed, and the whole frame is scanned every incrementalRefreshInterval scans, or when the
+* model, the frame size or the scan settings change.
+* Only called by the first stage, which processes one frame at a time, in order.
+* @param[in,out] state frame to scan. Its block counters are set if only part of the frame is scanned.
+* @return candidate ROIs, in the coordinates of the cropped frame
+*/
+std::vector<cv::Rect> ObjDetector::scanIncrementally(FrameState& state) const
+{
+	const DetectionParams& params = state.model->params();
+	const LatencyController::Plan& plan = state.plan;
+	ScanHistory& history = scanHistory_;
+	cv::cvtColor(state.cropped, history.gray, CV_BGR2GRAY);
+
+	const bool isRefresh = (history.model != state.model) || (history.reference.size() != history.gray.size()) ||
+		(history.plan.scaleFactor != plan.scaleFactor) || (history.plan.minWin != plan.minWin) || (history.plan.maxWin != plan.maxWin) ||
+		(++history.nScans >= params.incrementalRefreshInterval);
+	cv::Mat dirty;	//changed pixels, empty to scan the whole frame
+	if (isRefresh)
+	{
+		history.model = state.model;
+		history.plan = plan;
+		history.nScans = 0;
+		cv::swap(history.reference, history.gray);	//the buffer of the old reference is recycled for the next conversion
+	}
+	else
+	{
+		const int blockSize = params.incrementalBlockSize;
+		const cv::Size nBlocks((history.gray.cols + blockSize - 1) / blockSize, (history.gray.rows + blockSize - 1) / blockSize);
+		cv::absdiff(history.gray, history.reference, history.difference);
+		cv::resize(history.difference, history.blockDifference, nBlocks, 0, 0, cv::INTER_AREA);
+		cv::Mat dirtyBlocks;
+		cv::threshold(history.blockDifference, dirtyBlocks, params.incrementalThreshold, 255, cv::THRESH_BINARY);
+		cv::resize(dirtyBlocks, dirty, history.gray.size(), 0, 0, cv::INTER_NEAREST);
+		history.gray.copyTo(history.reference, dirty);
+		state.nBlocks = nBlocks.area();
+		state.nDirtyBlocks = cv::countNonZero(dirtyBlocks);
+	}
+	return state.model->detectCandidates(state.cropped, plan.scaleFactor, plan.minWin, plan.maxWin, state.mask, dirty, history.rawHits);
+}
+
+/*!
+* Decides whether a tracked object has to be verified by the SVM in the current frame.
+* Only objects that are confirmed, and were confirmed in the previous frame, can skip the verification,
+* so that skipping never changes how the age of an object is counted against maxAgePre/PostConfirmation.
+* The decision relies on the tracker measuring its forward-backward error and NCC independently of the forward result,
+* so that a drifting track reports a large error or a low correlation.
+* @param[in] slot slot of the track in secondStageOutputs_
+* @param[in] quality goodness of fit reported by the tracker in the current frame
+* @return true if the SVM must be run on the tracked object
+*/
+bool ObjDetector::needsVerification(std::size_t slot, const MedianFlowQuality& quality) const
+{
+	if ((params().reverifyMaxInterval <= 1) ||
+		(secondStageOutputs_.ages[slot] != 0) ||
+		(secondStageOutputs_.nTimesSeen[slot] <= params().nHangOverFrames) ||
+		(secondStageOutputs_.nFramesSinceVerification[slot] + 1 >= params().reverifyMaxInterval))
+	{
+		return true;
+	}
+	return (quality.fbError > params().reverifyMaxFBError) ||
+		(quality.ncc < params().reverifyMinNCC) ||
+		(std::abs(quality.scale - 1.f) > params().reverifyMaxScaleChange);
 }
 
 std::vector<ObjDetector::DetectionInfo> ObjDetector::getStage2Rois() const
 {
 	std::vector<DetectionInfo> result;
-	for (const auto& obj : secondStageOutputs_)
+	for (std::size_t i = 0; i < secondStageOutputs_.size(); ++i)
 	{
-		result.push_back({ obj.roi, obj.confidence });
+		result.push_back({ secondStageOutputs_.rois[i], secondStageOutputs_.confidences[i], 0, std::string(), secondStageOutputs_.ids[i] });
 	}
 	return result;
 }
@@ -466,167 +871,94 @@ void ObjDetector::dumpStage1(std::string prefix){
 
 void ObjDetector::dumpStage2(std::string prefix){
 	int cnt = 0;
-	for (const auto& r : secondStageOutputs_){
+	for (std::size_t i = 0; i < secondStageOutputs_.size(); ++i){
 		cnt++;
-		cv::Mat p = currFrame(r.roi);
-		std::string fname = prefix + "_" + std::to_string(counter_) + "_" + std::to_string(cnt) + "_" + std::to_string(r.confidence) + ".png";
+		cv::Mat p = currFrame(secondStageOutputs_.rois[i]);
+		std::string fname = prefix + "_" + std::to_string(counter_) + "_" + std::to_string(cnt) + "_" + std::to_string(secondStageOutputs_.confidences[i]) + ".png";
 		cv::imwrite(fname, p);
 	}
 }
 
-std::vector<ObjDetector::DetectionInfo> ObjDetector::refineDetections(std::vector<DetectionInfo> rois, float scale){
-	
-	//std::cerr << "Frame # " << this->counter_ << std::endl;
-
-	cv::Mat tmp;
-	cropped_.copyTo(tmp);
-
-	std::vector<DetectionInfo> refined_rois;
-	for (const auto& r : rois){
-	
-		//std::cerr << r.roi << std::endl;
-		
-		int horSpan = floor(r.roi.width / 2 * scale);
-		int vertSpan = floor(r.roi.height / 2 * scale);
-		int new_x = r.roi.x - horSpan;
-		int new_y = r.roi.y - vertSpan;
-		if (new_x < 0)
-			new_x = 0;
-		if (new_y < 0)
-			new_y = 0;
-		
-		int new_width = r.roi.width + 2*horSpan;
-		int new_height = r.roi.height + 2*vertSpan;
-
-		if (new_x + new_width > cropped_.size().width){
-			new_width = cropped_.size().width - new_x;
-		}
-		if (new_y + new_height > cropped_.size().height){
-			new_height = cropped_.size().height - new_y;
-		}
-		
-		cv::Mat patch = cropped_(cv::Rect(new_x,new_y,new_width, new_height));
-		//imshow("Patch", patch);
-		//std::cerr << "# " << counter_ << std::endl;
-		//std::vector<cv::Rect> det = pCascadeDetector->detectNoGrouping(patch, 1.01, params_.cascadeMinWin, patch.size());
-		std::vector<cv::Rect> det = pCascadeDetector->detect(patch, 1.01, params_.cascadeMinWin, patch.size());
-
-		//std::cerr << "Size of det: " << det.size() << std::endl;
-
-		std::vector<DetectionInfo> result;
-
-		for (const auto& d : det){
-			auto res = pSVMClassifier->classify(patch(d));  //TODO: If SVM is using grayscale, we should just pass it the grayscale image to reduce computation
-			
-			if ((1 == res.first) && (res.second > params_.SVMThreshold)){ //svm confirms detection
-				//cv::Rect tmp_roi(d.x + new_x, d.y + new_y, d.width, d.height);
-				cv::Rect tmp_roi(d.x + new_x, d.y + new_y, d.width, d.height);
-				result.push_back({ tmp_roi, res.second, 0 });
-			}
-		}
-
-		//find roi with max confidence
-		float max_conf = -1;
-		std::vector<ObjDetector::DetectionInfo>::iterator best_it;
-		std::vector<ObjDetector::DetectionInfo>::iterator it = result.begin();
-		for (; it != result.end(); ++it){
-			if (it->confidence > max_conf){
-				max_conf = it->confidence;
-				best_it = it;
-			}
-		}
-
-		//debug
-		
-		cv::rectangle(tmp, r.roi, cv::Scalar(255, 0, 0), 2);
-
-		if (max_conf > 0){
-			cv::rectangle(tmp, best_it->roi, cv::Scalar(0, 255, 0), 2);
-			refined_rois.push_back(*best_it);
+/*!
+* Tightens the box of a detection: the cascade scans a region around it, with windows within a bounded range around its size,
+* and the candidate the SVM is most confident about replaces the box if it beats the detection's own confidence. The cost is bounded by the size of the region and of
+* the range, whatever the frame.
+* @param[in] model model to use
+* @param[in] image image the detection was found in
+* @param[in] detection detection to refine
+* @return the refined detection, or the detection itself if no candidate confirmed by the SVM is more confident
+*/
+ObjDetector::DetectionInfo ObjDetector::refineDetection(const DetectorModel& model, const cv::Mat& image, const DetectionInfo& detection)
+{
+	const DetectionParams& params = model.params();
+	const cv::Rect& roi = detection.roi;
+	const int dx = cvRound(params.refinementMargin * roi.width);
+	const int dy = cvRound(params.refinementMargin * roi.height);
+	const cv::Rect region = cv::Rect(roi.x - dx, roi.y - dy, roi.width + 2 * dx, roi.height + 2 * dy) & cv::Rect(0, 0, image.cols, image.rows);
+	const cv::Size minSize(cvFloor(params.refinementMinScale * roi.width), cvFloor(params.refinementMinScale * roi.height));
+	const cv::Size maxSize(std::min(region.width, cvCeil(params.refinementMaxScale * roi.width)), std::min(region.height, cvCeil(params.refinementMaxScale * roi.height)));
+
+	DetectionInfo refined = detection;
+	if ((maxSize.width < minSize.width) || (maxSize.height < minSize.height))
+		return refined;
+	const cv::Mat patch = image(region);
+	double bestConfidence = detection.confidence;	//the original box wins unless a candidate beats it
+	for (const auto& candidate : model.detectCandidates(patch, params.refinementScaleFactor, minSize, maxSize))
+	{
+		const auto res = model.classify(patch(candidate));
+		if ((1 == res.first) && (res.second > params.SVMThreshold) && (res.second > bestConfidence)) //svm confirms detection
+		{
+			bestConfidence = res.second;
+			refined.roi = candidate + region.tl();
+			refined.confidence = res.second;
 		}
-		
-	
-		//refined_rois = result; //DEBUG
 	}
-	//std::cerr << "size of ref. " << refined_rois.size() << std::endl;
-	cv::imshow("Refinement", tmp);
-	
-	
-
-	return refined_rois;
-
+	return refined;
 }
 
-
-ObjDetector::DetectionInfo ObjDetector::refineDetection(cv::Rect roi , float scale){
-
-	//std::cerr << "Frame # " << this->counter_ << std::endl;
-
-	DetectionInfo refined_roi;
-
-	cv::Mat tmp;
-	cropped_.copyTo(tmp);
-	cv::rectangle(tmp, roi, cv::Scalar(255, 0, 0), 2);
-		//std::cerr << r.roi << std::endl;
-
-		int horSpan = floor(roi.width / 2 * scale);
-		int vertSpan = floor(roi.height / 2 * scale);
-		int new_x = roi.x - horSpan;
-		int new_y = roi.y - vertSpan;
-		if (new_x < 0)
-			new_x = 0;
-		if (new_y < 0)
-			new_y = 0;
-
-		int new_width = roi.width + 2 * horSpan;
-		int new_height = roi.height + 2 * vertSpan;
-
-		if (new_x + new_width > cropped_.size().width){
-			new_width = cropped_.size().width - new_x;
-		}
-		if (new_y + new_height > cropped_.size().height){
-			new_height = cropped_.size().height - new_y;
-		}
-
-		cv::Mat patch = cropped_(cv::Rect(new_x, new_y, new_width, new_height));
-		//cv::imshow("Patch", patch);
-		//std::cerr << "# " << counter_ << std::endl;
-		//std::vector<cv::Rect> det = pCascadeDetector->detectNoGrouping(patch, 1.01, params_.cascadeMinWin, patch.size());
-		std::vector<cv::Rect> det = pCascadeDetector->detect(patch, 1.01, params_.cascadeMinWin, patch.size());
-
-		//std::cerr << "Size of det: " << det.size() << std::endl;
-
-		std::vector<DetectionInfo> result;
-
-		for (const auto& d : det){
-			auto res = pSVMClassifier->classify(patch(d));  //TODO: If SVM is using grayscale, we should just pass it the grayscale image to reduce computation
-
-			if ((1 == res.first) && (res.second > params_.SVMThreshold)){ //svm confirms detection
-				//cv::Rect tmp_roi(d.x + new_x, d.y + new_y, d.width, d.height);
-				cv::Rect tmp_roi(d.x + new_x, d.y + new_y, d.width, d.height);
-				result.push_back({ tmp_roi, res.second, 0 });
-			}
-		}
-
-		//find roi with max confidence
-		float max_conf = -1;
-		std::vector<ObjDetector::DetectionInfo>::iterator best_it;
-		std::vector<ObjDetector::DetectionInfo>::iterator it = result.begin();
-		for (; it != result.end(); ++it){
-			if (it->confidence > max_conf){
-				max_conf = it->confidence;
-				best_it = it;
-			}
-		}
-		if (max_conf > 0){
-			refined_roi = { best_it->roi, max_conf, 0 };
-			cv::rectangle(tmp, best_it->roi, cv::Scalar(0, 255, 0), 2);
+/*!
+* Tightens the boxes of the detections of a frame, concurrently. With a budget, the most confident detections are refined
+* first, and no refinement starts once the budget is spent, so a frame overruns it by at most one refinement per thread.
+* @param[in] model model to use
+* @param[in] image image the detections were found in
+* @param[in,out] detections detections to refine, in place. Their order is kept.
+* @param[in] pool workers sharing the work with the calling thread. If null, the detections are refined on the calling thread only.
+* @param[in,out] nRefined incremented by the number of boxes changed
+* @param[in,out] nSkipped incremented by the number of detections left unrefined because of the budget
+*/
+void ObjDetector::refineDetections(const DetectorModel& model, const cv::Mat& image, std::vector<DetectionInfo>& detections, ThreadPool* pool, unsigned long& nRefined, unsigned long& nSkipped)
+{
+	const auto startTime = std::chrono::steady_clock::now();
+	const double budget = model.params().refinementBudget;
+	std::vector<std::size_t> order(detections.size());
+	for (std::size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&detections](std::size_t i, std::size_t j){ return detections[i].confidence > detections[j].confidence; });
+
+	// each refinement only writes its own slot
+	std::vector<char> isSkipped(detections.size(), false);
+	std::vector<char> isChanged(detections.size(), false);
+	auto refine = [&](std::size_t k)
+	{
+		const std::size_t i = order[k];
+		if ((budget > 0.) && (elapsedMilliseconds(startTime) > budget))
+		{
+			isSkipped[i] = true;
+			return;
 		}
-		else
-			refined_roi = { roi, -1, 0 }; 
-		//refined_rois = result; //DEBUG
-		cv::imshow("Single ref", tmp);
-	//std::cerr << "size of ref. " << refined_rois.size() << std::endl;
-	return refined_roi;
-
+		const DetectionInfo refined = refineDetection(model, image, detections[i]);
+		isChanged[i] = (refined.roi != detections[i].roi);
+		detections[i] = refined;
+	};
+	if (pool)
+	{
+		pool->parallelFor(order.size(), refine);
+	}
+	else
+	{
+		for (std::size_t k = 0; k < order.size(); ++k)
+			refine(k);
+	}
+	nRefined += std::count(isChanged.begin(), isChanged.end(), true);
+	nSkipped += std::count(isSkipped.begin(), isSkipped.end(), true);
 }
\ No newline at end of file
@@ -0,0 +1,233 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "QuantizedSVM.h"
+#include "svm.h"
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define SIGNFINDER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SIGNFINDER_NEON
+#endif
+
+namespace
+{
+	static const int QMAX = 127;				//< quantized values are in [-QMAX, QMAX], so that two products fit in int16
+	static const std::size_t LANES = 16;		//< int8 values processed per iteration of the dot product
+	static const double MIN_PROB = 1e-7;		//< probability bounds, as in libsvm
+
+	/// @return n rounded up to a multiple of LANES
+	inline std::size_t padded(std::size_t n)
+	{
+		return (n + LANES - 1) / LANES * LANES;
+	}
+
+	/// @return value * scale, rounded and saturated to [-QMAX, QMAX]
+	inline std::int8_t quantize(double value, double scale)
+	{
+		const long q = std::lround(value * scale);
+		return (std::int8_t)std::min<long>(std::max<long>(q, -QMAX), QMAX);
+	}
+
+	/// Dot product of two int8 vectors
+	/// @param[in] a first vector
+	/// @param[in] b second vector
+	/// @param[in] n length of the vectors, a multiple of LANES
+	/// @return the dot product
+	std::int32_t dot(const std::int8_t* a, const std::int8_t* b, std::size_t n)
+	{
+#if defined(SIGNFINDER_SSE2)
+		__m128i acc = _mm_setzero_si128();
+		for (std::size_t i = 0; i < n; i += LANES)
+		{
+			const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+			const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+			//sign extend to int16 by unpacking each byte into the high half of a word and shifting it back down
+			const __m128i aLo = _mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8);
+			const __m128i aHi = _mm_srai_epi16(_mm_unpackhi_epi8(va, va), 8);
+			const __m128i bLo = _mm_srai_epi16(_mm_unpacklo_epi8(vb, vb), 8);
+			const __m128i bHi = _mm_srai_epi16(_mm_unpackhi_epi8(vb, vb), 8);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(aLo, bLo));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(aHi, bHi));
+		}
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtsi128_si32(acc);
+#elif defined(SIGNFINDER_NEON)
+		int32x4_t acc = vdupq_n_s32(0);
+		for (std::size_t i = 0; i < n; i += LANES)
+		{
+			const int8x16_t va = vld1q_s8(a + i);
+			const int8x16_t vb = vld1q_s8(b + i);
+			int16x8_t products = vmull_s8(vget_low_s8(va), vget_low_s8(vb));
+			products = vmlal_s8(products, vget_high_s8(va), vget_high_s8(vb));	//at most 2 * QMAX^2, fits in int16
+			acc = vpadalq_s16(acc, products);
+		}
+		return vgetq_lane_s32(acc, 0) + vgetq_lane_s32(acc, 1) + vgetq_lane_s32(acc, 2) + vgetq_lane_s32(acc, 3);
+#else
+		std::int32_t acc = 0;
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			acc += (std::int32_t)a[i] * (std::int32_t)b[i];
+		}
+		return acc;
+#endif
+	}
+
+	/// Platt scaling of a decision value, as in libsvm
+	inline double sigmoidPredict(double decisionValue, double A, double B)
+	{
+		const double fApB = decisionValue * A + B;
+		return (fApB >= 0 ? std::exp(-fApB) / (1. + std::exp(-fApB)) : 1. / (1. + std::exp(fApB)));
+	}
+}   //::<anon>
+
+QuantizedSVM::QuantizedSVM(const svm_model* model, float scale) throw(std::runtime_error) :
+weightScale_(1.)
+{
+	if (!supports(model))
+	{
+		throw std::runtime_error("QuantizedSVM :: Only binary classifiers with probability estimates and a linear, polynomial, RBF or sigmoid kernel can be quantized");
+	}
+	kernelType_ = model->param.kernel_type;
+	degree_ = model->param.degree;
+	gamma_ = model->param.gamma;
+	coef0_ = model->param.coef0;
+	rho_ = model->rho[0];
+	probA_ = model->probA[0];
+	probB_ = model->probB[0];
+	labels_[0] = model->label[0];
+	labels_[1] = model->label[1];
+	const float maxValue = maxAbsValue(model);
+	scale_ = (scale > 0.f ? scale : (maxValue > 0.f ? QMAX / maxValue : 1.f));
+
+	int maxIndex = 0;
+	for (int i = 0; i < model->l; ++i)
+	{
+		for (const svm_node* node = model->SV[i]; node->index != -1; ++node)
+			maxIndex = std::max(maxIndex, node->index);
+	}
+	dims_ = padded(maxIndex);
+
+	if (LINEAR == kernelType_)	//the decision value is linear in the descriptor, fold the support vectors into weights
+	{
+		std::vector<double> weights(dims_, 0.);
+		for (int i = 0; i < model->l; ++i)
+		{
+			for (const svm_node* node = model->SV[i]; node->index != -1; ++node)
+				weights[node->index - 1] += model->sv_coef[0][i] * node->value;
+		}
+		double maxWeight = 0.;
+		for (const auto w : weights)
+			maxWeight = std::max(maxWeight, std::abs(w));
+		weightScale_ = (maxWeight > 0. ? QMAX / maxWeight : 1.);
+		nVectors_ = 1;
+		vectors_.resize(dims_);
+		for (std::size_t d = 0; d < dims_; ++d)
+			vectors_[d] = quantize(weights[d], weightScale_);
+	}
+	else
+	{
+		nVectors_ = model->l;
+		vectors_.assign(nVectors_ * dims_, 0);
+		for (std::size_t i = 0; i < nVectors_; ++i)
+		{
+			for (const svm_node* node = model->SV[i]; node->index != -1; ++node)
+				vectors_[i * dims_ + node->index - 1] = quantize(node->value, scale_);
+		}
+	}
+	sqNorms_.resize(nVectors_);
+	coefs_.resize(nVectors_);
+	for (std::size_t i = 0; i < nVectors_; ++i)
+	{
+		const std::int8_t* v = &vectors_[i * dims_];
+		sqNorms_[i] = dot(v, v, dims_);
+		coefs_[i] = (LINEAR == kernelType_ ? 1. : model->sv_coef[0][i]);
+	}
+}
+
+bool QuantizedSVM::supports(const svm_model* model)
+{
+	if (!model || (model->nr_class != 2) || !model->probA || !model->probB)
+		return false;
+	const int svmType = model->param.svm_type;
+	const int kernelType = model->param.kernel_type;
+	return ((C_SVC == svmType) || (NU_SVC == svmType)) &&
+		((LINEAR == kernelType) || (POLY == kernelType) || (RBF == kernelType) || (SIGMOID == kernelType));
+}
+
+float QuantizedSVM::maxAbsValue(const svm_model* model)
+{
+	double maxValue = 0.;
+	for (int i = 0; i < model->l; ++i)
+	{
+		for (const svm_node* node = model->SV[i]; node->index != -1; ++node)
+			maxValue = std::max(maxValue, std::abs(node->value));
+	}
+	return (float)maxValue;
+}
+
+double QuantizedSVM::decisionValue(const std::vector<float>& descriptor) const
+{
+	std::vector<std::int8_t> x(dims_, 0);
+	const std::size_t n = std::min(descriptor.size(), dims_);
+	for (std::size_t d = 0; d < n; ++d)
+		x[d] = quantize(descriptor[d], scale_);
+
+	if (LINEAR == kernelType_)
+	{
+		return dot(x.data(), vectors_.data(), dims_) / (scale_ * weightScale_) - rho_;
+	}
+
+	//values beyond the support vectors still count in the distance of the RBF kernel, as in libsvm
+	std::int64_t xx = dot(x.data(), x.data(), dims_);
+	for (std::size_t d = n; d < descriptor.size(); ++d)
+	{
+		const std::int32_t q = quantize(descriptor[d], scale_);
+		xx += q * q;
+	}
+	const double invSqScale = 1. / ((double)scale_ * scale_);
+	double sum = 0.;
+	for (std::size_t i = 0; i < nVectors_; ++i)
+	{
+		const std::int32_t xv = dot(x.data(), &vectors_[i * dims_], dims_);
+		double k;
+		switch (kernelType_)
+		{
+		case RBF:
+			k = std::exp(-gamma_ * (double)(xx + sqNorms_[i] - 2 * (std::int64_t)xv) * invSqScale);
+			break;
+		case POLY:
+			k = std::pow(gamma_ * xv * invSqScale + coef0_, degree_);
+			break;
+		default:	//SIGMOID
+			k = std::tanh(gamma_ * xv * invSqScale + coef0_);
+			break;
+		}
+		sum += coefs_[i] * k;
+	}
+	return sum - rho_;
+}
+
+int QuantizedSVM::predictProbability(const std::vector<float>& descriptor, double probEstimates[2]) const
+{
+	const double p = sigmoidPredict(decisionValue(descriptor), probA_, probB_);
+	probEstimates[0] = std::min(std::max(p, MIN_PROB), 1. - MIN_PROB);
+	probEstimates[1] = 1. - probEstimates[0];
+	return (probEstimates[1] > probEstimates[0] ? labels_[1] : labels_[0]);
+}
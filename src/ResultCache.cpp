@@ -0,0 +1,142 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ResultCache.h"
+#include <bitset>
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace
+{
+	static const int HASH_SIDE = 16;	//< side of the thumbnail the hash is computed from, one bit per pixel
+}   //::<anon>
+
+ResultCache::ResultCache(std::size_t capacity, int maxDistance, int maxReuse) :
+capacity_(capacity),
+maxDistance_(maxDistance),
+maxReuse_(maxReuse)
+{
+}
+
+void ResultCache::configure(std::size_t capacity, int maxDistance, int maxReuse)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	capacity_ = capacity;
+	maxDistance_ = maxDistance;
+	maxReuse_ = maxReuse;
+	entries_.clear();
+	model_.reset();
+}
+
+/*!
+* Computes the average hash of an image. The area resampling of OpenCV reads each pixel once, so this costs a small fraction
+* of a cascade scan, and the rest of the work is on the 256 cells of the thumbnail.
+* @param[in] image grayscale, BGR or BGRA 8 bits image
+* @return the hash, whose bits are set where the thumbnail is brighter than its mean, in row order
+*/
+ResultCache::Hash ResultCache::hashImage(const cv::Mat& image)
+{
+	cv::Mat thumbnail;
+	cv::resize(image, thumbnail, cv::Size(HASH_SIDE, HASH_SIDE), 0, 0, cv::INTER_AREA);
+	if (3 == thumbnail.channels())
+		cv::cvtColor(thumbnail, thumbnail, CV_BGR2GRAY);
+	else if (4 == thumbnail.channels())
+		cv::cvtColor(thumbnail, thumbnail, CV_BGRA2GRAY);
+
+	int sum = 0;
+	for (int y = 0; y < HASH_SIDE; ++y)
+	{
+		const unsigned char* row = thumbnail.ptr<unsigned char>(y);
+		for (int x = 0; x < HASH_SIDE; ++x)
+			sum += row[x];
+	}
+	Hash hash = { { 0, 0, 0, 0 } };
+	for (int y = 0; y < HASH_SIDE; ++y)
+	{
+		const unsigned char* row = thumbnail.ptr<unsigned char>(y);
+		for (int x = 0; x < HASH_SIDE; ++x)
+		{
+			const int bit = y * HASH_SIDE + x;
+			if (HASH_SIDE * HASH_SIDE * row[x] > sum)	//compared to the mean without dividing
+				hash[bit / 64] |= (std::uint64_t(1) << (bit % 64));
+		}
+	}
+	return hash;
+}
+
+int ResultCache::distance(const Hash& hash1, const Hash& hash2)
+{
+	int bits = 0;
+	for (std::size_t i = 0; i < hash1.size(); ++i)
+		bits += (int)std::bitset<64>(hash1[i] ^ hash2[i]).count();
+	return bits;
+}
+
+bool ResultCache::isSameView(const Hash& hash1, const Hash& hash2) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return distance(hash1, hash2) <= maxDistance_;
+}
+
+bool ResultCache::find(const std::shared_ptr<const DetectorModel>& model, cv::Size size, const Hash& hash, Result& result)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (model != model_)
+		return false;
+	for (auto it = entries_.begin(); it != entries_.end(); ++it)
+	{
+		if ((it->size != size) || (distance(it->hash, hash) > maxDistance_))
+			continue;
+		if ((maxReuse_ > 0) && (it->nReused >= maxReuse_))	//expired, so that a change the hash misses does not last
+		{
+			entries_.erase(it);
+			return false;
+		}
+		++it->nReused;
+		entries_.splice(entries_.begin(), entries_, it);
+		result = it->result;
+		return true;
+	}
+	return false;
+}
+
+void ResultCache::insert(const std::shared_ptr<const DetectorModel>& model, cv::Size size, const Hash& hash, const Result& result)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (0 == capacity_)
+		return;
+	if (model != model_)	//results of another model are stale
+	{
+		entries_.clear();
+		model_ = model;
+	}
+	for (auto it = entries_.begin(); it != entries_.end(); ++it)
+	{
+		if ((it->size == size) && (distance(it->hash, hash) <= maxDistance_))	//replaces the view's previous result
+		{
+			entries_.erase(it);
+			break;
+		}
+	}
+	entries_.push_front({ size, hash, result, 0 });
+	if (entries_.size() > capacity_)
+		entries_.pop_back();
+}
+
+void ResultCache::clear()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	entries_.clear();
+	model_.reset();
+}
@@ -0,0 +1,134 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+ThreadPool::ThreadPool(unsigned int nThreads) :
+stop_(false)
+{
+	if (0 == nThreads)
+	{
+		nThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	workers_.reserve(nThreads);
+	for (unsigned int i = 0; i < nThreads; ++i)
+	{
+		workers_.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	for (auto& worker : workers_)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::enqueue(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		tasks_.push_back(std::move(task));
+	}
+	cv_.notify_one();
+}
+
+void ThreadPool::workerLoop()
+{
+	for (;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_.wait(lock, [this]{ return stop_ || !tasks_.empty(); });
+			if (tasks_.empty())	//stopping and nothing left to do
+				return;
+			task = std::move(tasks_.front());
+			tasks_.pop_front();
+		}
+		task();
+	}
+}
+
+/*!
+* Items are handed out one at a time from a shared counter. Helper tasks that start after all
+* items have been handed out return immediately, so the caller never waits on a queued task.
+*/
+void ThreadPool::parallelFor(std::size_t n, const std::function<void(std::size_t)>& fn)
+{
+	if (0 == n)
+		return;
+	if (1 == n || workers_.empty())
+	{
+		for (std::size_t i = 0; i < n; ++i)
+			fn(i);
+		return;
+	}
+
+	struct SharedState
+	{
+		std::atomic<std::size_t> next;
+		std::size_t nDone;
+		std::exception_ptr error;
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+	auto pState = std::make_shared<SharedState>();
+	pState->next = 0;
+	pState->nDone = 0;
+	const std::function<void(std::size_t)>* pFn = &fn;	//only dereferenced while the caller is still waiting
+
+	auto work = [pState, pFn, n]()
+	{
+		for (std::size_t i = pState->next++; i < n; i = pState->next++)
+		{
+			std::exception_ptr error;
+			try
+			{
+				(*pFn)(i);
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+			}
+			std::lock_guard<std::mutex> lock(pState->mutex);
+			if (error && !pState->error)
+				pState->error = error;
+			if (++pState->nDone == n)
+				pState->done.notify_all();
+		}
+	};
+
+	const std::size_t nHelpers = std::min(workers_.size(), n - 1);
+	for (std::size_t h = 0; h < nHelpers; ++h)
+	{
+		enqueue(work);
+	}
+	work();
+
+	std::unique_lock<std::mutex> lock(pState->mutex);
+	pState->done.wait(lock, [&pState, n]{ return pState->nDone == n; });
+	if (pState->error)
+		std::rethrow_exception(pState->error);
+}
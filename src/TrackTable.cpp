@@ -0,0 +1,83 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "TrackTable.h"
+#include <cassert>
+
+TrackTable::TrackTable() :
+nextId_(1)
+{
+}
+
+TrackTable::~TrackTable() = default;
+
+TrackTable::TrackId TrackTable::add(const cv::Rect& roi, double confidence, int age, int nTimesSeen)
+{
+	const TrackId id = nextId_++;
+	ids.push_back(id);
+	rois.push_back(roi);
+	confidences.push_back(confidence);
+	ages.push_back(age);
+	this->nTimesSeen.push_back(nTimesSeen);
+	nFramesSinceVerification.push_back(0);
+	velocities.push_back(cv::Point2f(0.f, 0.f));
+	motionResiduals.push_back(0.f);
+	nMotionSamples.push_back(0);
+	return id;
+}
+
+/*!
+* Swap-removes a track: the last slot is moved into the removed one, and the table shrinks by one.
+* @param[in] slot slot of the track to remove
+*/
+void TrackTable::remove(std::size_t slot)
+{
+	assert(slot < size());
+	const std::size_t last = size() - 1;
+	if (slot != last)
+	{
+		ids[slot] = ids[last];
+		rois[slot] = rois[last];
+		confidences[slot] = confidences[last];
+		ages[slot] = ages[last];
+		nTimesSeen[slot] = nTimesSeen[last];
+		nFramesSinceVerification[slot] = nFramesSinceVerification[last];
+		velocities[slot] = velocities[last];
+		motionResiduals[slot] = motionResiduals[last];
+		nMotionSamples[slot] = nMotionSamples[last];
+	}
+	ids.pop_back();
+	rois.pop_back();
+	confidences.pop_back();
+	ages.pop_back();
+	nTimesSeen.pop_back();
+	nFramesSinceVerification.pop_back();
+	velocities.pop_back();
+	motionResiduals.pop_back();
+	nMotionSamples.pop_back();
+}
+
+void TrackTable::clear()
+{
+	ids.clear();
+	rois.clear();
+	confidences.clear();
+	ages.clear();
+	nTimesSeen.clear();
+	nFramesSinceVerification.clear();
+	velocities.clear();
+	motionResiduals.clear();
+	nMotionSamples.clear();
+}
@@ -18,14 +18,25 @@
  */
 
 
+#include <algorithm>
+#include <atomic>
 #include <exception>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <string>
+#include <thread>
+#include <sys/stat.h>
 #include "opencv2/core/core.hpp"
 #include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "BoundedQueue.h"
+#include "BufferPool.h"
+#include "DetectionLog.h"
+#include "MedianFlowTracker.hpp"
+#include "ModelWatcher.h"
 #include "ObjDetector.h"
+#include "ThreadPool.h"
 #include "version.h"
 
 namespace
@@ -35,22 +46,34 @@ namespace
 	{
 		std::string configFile;         //< The configuration file in YAML format
 		std::string input;              //< input file stream to process
+		std::string inputList;          //< if non-empty, text file listing inputs to process concurrently
+		std::string batch;              //< if non-empty, directory or text file listing still images, processed independently
 		std::string output;             //< name of output file if one is given
 		std::string patchPrefix;        //< if non-empty, dump patches to disk with this prefix
 		std::string roisFile;			//< if non-empty, saves detection ROIs to the specified file
+		std::string binLogFile;         //< if non-empty, saves detections to a binary detection log with this name
 		std::string label;				//< label for the ROIs
 		int maxDim;                     //< maximum dimension of the image in pixels
+		int queueSize;                  //< number of frames buffered between two pipeline stages
+		double deadline;                //< real-time deadline per frame in milliseconds (0: off, negative: as in the configuration file)
+		int nJobs;                      //< number of inputs processed concurrently from inputList (0: one per hardware thread)
+		int watchPeriod;                //< if positive, the configuration and classifier files are polled every this many ms, and reloaded when changed
+		int stride;                     //< the detection runs on every stride-th frame only, the frames in between get interpolated results
+		bool doStrideTracking;          //< whether the frames skipped by the stride are retrieved and resized, and the detections tracked through them
 		bool isFlipped;					//< flip input image if true (used for landscape videos)
 		bool isTransposed;				//< transpose input image if true (used for landscape videos)
 		bool doShowIntermediate;        //< show debugging info
 		bool doSaveFrames;              //< if true, save frames to disk
 		bool doTrack;                   //< whether the detector should us tracking.
+		bool isHeadless;                //< if true, no window, overlay or frame output, only detections are emitted
 	};
 
 	/// Prints basic usage to terminal
 	inline void printUsage()
 	{
-		std::cerr << "USAGE: SignFinder -c configfile [-p prefix] [-m maxdim] [-r roisFilename] [-s] [-d] [-f] [-t] [-n] [-o output] -i input" << std::endl;
+		std::cerr << "USAGE: SignFinder -c configfile [-p prefix] [-m maxdim] [-q queuesize] [-D deadline] [-w watchPeriod] [-S stride] [-T] [-r roisFilename] [-b binLog] [-s] [-d] [-f] [-t] [-n] [-x] [-o output] -i input" << std::endl;
+		std::cerr << "       SignFinder -c configfile [-m maxdim] [-w watchPeriod] [-S stride] [-T] [-r roisFilename] [-b binLog] [-f] [-t] [-n] [-j jobs] -L inputList" << std::endl;
+		std::cerr << "       SignFinder -c configfile [-m maxdim] [-r roisFilename] [-f] [-t] [-j jobs] -B imageDirOrList" << std::endl;
 	}
 
 	/// Parses command line options
@@ -65,6 +88,9 @@ namespace
 			"{ h | help            | false       | print this message                                            }"
 			"{ v | version         | false       | version info                                                  }"
 			"{ i | input           |             | input. Either a file name, or a digit indicating webcam id    }"
+			"{ L | inputList       |             | text file listing one input per line. The inputs are processed concurrently, headless, sharing one model.}"
+			"{ B | batch           |             | directory of still images, or text file listing one image per line, processed independently in parallel}"
+			"{ j | jobs            | 0           | number of inputs processed concurrently with --inputList or --batch (0: one per hardware thread)}"
 			"{ c | configFile      |             | location of config file                                       }"
 			"{ p | patchPrefix     |             | prefix for dumping detected patches to disk. If none, nothign is dumped}"
 			"{ s | saveFrames      | false       | whether to save frames                                        }"
@@ -72,10 +98,17 @@ namespace
 			"{ f | flip            | false       | whether to flip the input image                               }"
 			"{ t | transpose       | false       | whether to transpose the input image                          }"
 			"{ n | notrack         | false       | whether to turn off tracking                                  }"
+			"{ x | headless        | false       | no display, overlays or frame output; only detections are written}"
+			"{ w | watch           | 0           | polls the config and classifier files every given ms, and reloads them when they change (0: off)}"
 			"{ m | maxdim          | 640         | maximum dimension of the image to use while processing.       }"
+			"{ q | queueSize       | 4           | number of frames buffered between the capture, detection and output stages.}"
+			"{ D | deadline        | -1          | real-time deadline per frame in ms; the work per frame is reduced to meet it (0: off, -1: from the config file)}"
 			"{ o | output          |             | if a name is specified, the detection results are saved to a video file given here.}"
 			"{ r | roisFile        |             | saves detected rois to a text file given here.                }"
+			"{ b | binLog          |             | saves detections to a compact binary log given here (see signfinder_logdump).}"
 			"{ l | label           |             | specify label for the ROIs.                                   }"
+			"{ S | stride          | 1           | detects every Nth frame only. The other frames are grabbed but not retrieved, resized or detected, and get results interpolated between the detected frames.}"
+			"{ T | strideTrack     | false       | with --stride, retrieves the skipped frames and tracks the detections through them instead of interpolating}"
 
 		};
 		cv::CommandLineParser parser(argc, argv, keys);
@@ -95,8 +128,10 @@ namespace
 		Options opts;
 
 		opts.input = parser.get<std::string>("i");
+		opts.inputList = parser.get<std::string>("L");
+		opts.batch = parser.get<std::string>("B");
 		std::cerr << opts.input << std::endl;
-		if (opts.input.empty())
+		if (opts.input.empty() && opts.inputList.empty() && opts.batch.empty())
 		{
 			printUsage();
 			throw std::runtime_error("Parser Error :: No input source specified");
@@ -111,13 +146,45 @@ namespace
 		opts.output = parser.get<std::string>("output");
 		opts.patchPrefix = parser.get<std::string>("p");
 		opts.roisFile = parser.get<std::string>("r");
+		opts.binLogFile = parser.get<std::string>("b");
 		opts.label = parser.get<std::string>("l");
 		opts.maxDim = parser.get<int>("m");
+		opts.queueSize = parser.get<int>("q");
+		if (opts.queueSize < 1)
+		{
+			throw std::runtime_error("Parser Error :: Queue size must be at least 1");
+		}
+		opts.deadline = parser.get<double>("D");
 		opts.doSaveFrames = parser.get<bool>("s");
 		opts.doShowIntermediate = parser.get<bool>("d");
 		opts.isTransposed = parser.get<bool>("t");
 		opts.isFlipped = parser.get<bool>("f");
 		opts.doTrack = !parser.get<bool>("n");
+		opts.isHeadless = parser.get<bool>("x");
+		opts.nJobs = parser.get<int>("j");
+		opts.watchPeriod = parser.get<int>("w");
+		opts.stride = parser.get<int>("S");
+		opts.doStrideTracking = parser.get<bool>("T");
+		if (opts.stride < 1)
+		{
+			throw std::runtime_error("Parser Error :: Stride must be at least 1");
+		}
+		if (opts.nJobs < 0)
+		{
+			throw std::runtime_error("Parser Error :: Number of jobs must not be negative");
+		}
+		if (!opts.inputList.empty() || !opts.batch.empty())	//several streams or images at once are always processed headless
+		{
+			opts.isHeadless = true;
+			opts.patchPrefix.clear();
+		}
+		if (opts.isHeadless && (opts.doSaveFrames || opts.doShowIntermediate || !opts.output.empty()))
+		{
+			std::cerr << "Headless mode: ignoring the frame saving, debug and video output options." << std::endl;
+			opts.doSaveFrames = false;
+			opts.doShowIntermediate = false;
+			opts.output.clear();
+		}
 
 #ifndef NDEBUG
 		//list arguments and parameters
@@ -134,12 +201,16 @@ namespace
 		std::clog << "\tisFlipped: " << opts.isFlipped << std::endl;
 		std::clog << "\tisTransposed: " << opts.isTransposed << std::endl;
 		std::clog << "\tmaxDim: " << opts.maxDim << std::endl;
+		std::clog << "\tqueueSize: " << opts.queueSize << std::endl;
+		std::clog << "\tdeadline: " << opts.deadline << std::endl;
+		std::clog << "\tstride: " << opts.stride << (opts.doStrideTracking ? " (tracked)" : "") << std::endl;
 
 		std::clog << "Debug options: " << std::endl;
 		std::clog << "\tpatchPrefix: " << opts.patchPrefix << std::endl;
 		std::clog << "\tdoShowIntermediate: " << opts.doShowIntermediate << std::endl;
 		std::clog << "\tdoSaveFrames: " << opts.doSaveFrames << std::endl;
 		std::clog << "\tnoTrack: " << !opts.doTrack << std::endl;
+		std::clog << "\theadless: " << opts.isHeadless << std::endl;
 #endif
 		return opts;
 	}
@@ -153,6 +224,20 @@ namespace
 	static const cv::Scalar COLOR_CANDIDATE = COLOR_YELLOW;
 	static const cv::Scalar COLOR_VERIFIED_SIGN = COLOR_GREEN;
 
+	/// A frame travelling through the capture, detection and output stages
+	struct FramePacket
+	{
+		int frameno;                                            //< index of the frame in the input, starting from 1
+		cv::Size inputSize;                                     //< size of the frame after resizing, before flipping or transposing
+		cv::Mat frame;                                          //< preprocessed frame, then the frame processed by the detector
+		double fps;                                             //< long-term average frame rate of the detector
+		std::size_t bytesCopied;                                //< bytes of image data copied while preprocessing and detecting this frame
+		bool isInterpolated;                                    //< true if the frame was skipped by the stride, and its results are tracked or interpolated
+		std::vector<ObjDetector::DetectionInfo> result;         //< verified detections
+		std::vector<cv::Rect> stage1Rois;                       //< first stage outputs, only filled when showing intermediate results
+		std::vector<ObjDetector::DetectionInfo> stage2Rois;     //< second stage outputs, only filled when showing intermediate results
+	};
+
 	/// Converts a size structure to a string
 	/// @param[in] sz size
 	/// @return stringified representation of sz
@@ -161,25 +246,18 @@ namespace
 	{
 		return std::to_string(sz.width) + "x" + std::to_string(sz.height);
 	}
-}   //::<anon>
 
-/// Main entry point
-/// @param[in] argc number of command line arguments (including program name)
-/// @param[in] argv list of arguments
-/// @return EXIT_SUCCESS if the program completes successfully, EXIT_FAILURE if an error occurs.
-int main(int argc, char* argv[])
-{
-	try
+	/// Opens an input stream
+	/// @param[in] input either a file name, or a digit indicating webcam id
+	/// @param[in] maxDim maximum dimension of the image, requested from webcams
+	/// @return the opened stream
+	/// @throw runtime_error if the stream cannot be opened
+	cv::VideoCapture openInput(const std::string& input, int maxDim)
 	{
-		auto options = parseOptions(argc, argv);
-
-		ObjDetector detector(options.configFile);
-
-		std::string videoname;
 		cv::VideoCapture vc;
-		if (options.input.size() == 1) //camera
+		if (input.size() == 1) //camera
 		{
-			const int camIndex = (char)options.input.front() - '0';
+			const int camIndex = (char)input.front() - '0';
 			std::cerr << camIndex << std::endl;
 			if ((camIndex < 0) || (camIndex > 9))
 			{
@@ -188,134 +266,777 @@ int main(int argc, char* argv[])
 			vc = cv::VideoCapture(camIndex);
 			if (!vc.isOpened())
 			{
-				throw std::runtime_error(std::string("Unable to open webcam ") + options.input);
+				throw std::runtime_error(std::string("Unable to open webcam ") + input);
 			}
 			//vc.set(CV_CAP_PROP_FRAME_HEIGHT, options.size.height);
-			vc.set(CV_CAP_PROP_FRAME_WIDTH, options.maxDim);
+			vc.set(CV_CAP_PROP_FRAME_WIDTH, maxDim);
 		}
 		else
 		{
-			vc = cv::VideoCapture(options.input);
+			vc = cv::VideoCapture(input);
 			if (!vc.isOpened())
 			{
-				throw std::runtime_error(std::string("Unable to open video file ") + options.input);
+				throw std::runtime_error(std::string("Unable to open video file ") + input);
 			}
 		}
 #ifndef NDEBUG
 		cv::Size openedStreamSize( vc.get(CV_CAP_PROP_FRAME_WIDTH), vc.get(CV_CAP_PROP_FRAME_HEIGHT) );
 		std::clog << "Opened stream size: " << openedStreamSize << std::endl;
 #endif
+		return vc;
+	}
 
-		assert(vc.isOpened());
-		cv::Mat frame;
-		int keypress;
-		int frameno = 0;
-		double fps = 0;
-		cv::VideoWriter vw;
+	/// Resizes, flips and transposes a decoded frame as requested by the options
+	/// @param[in] frame decoded frame
+	/// @param[in] options program options
+	/// @param[out] packet receives the preprocessed frame and its size before flipping or transposing
+	/// @param[in] pPool if not null, the buffers of the frame are taken from this pool, otherwise they are allocated
+	void preprocess(const cv::Mat& frame, const Options& options, FramePacket& packet, BufferPool* pPool = nullptr)
+	{
+		//the decoder reuses its buffer, so the frame has to be resampled into a buffer owned by the packet
+		const float scaleFactor = (float)options.maxDim / (float)std::max(frame.cols, frame.rows);
+		const cv::Size size(cvRound(frame.cols * scaleFactor), cvRound(frame.rows * scaleFactor));
+		packet.frame = (pPool ? pPool->acquire(size, frame.type()) : cv::Mat());
+		cv::resize(frame, packet.frame, size);
+		packet.inputSize = packet.frame.size();
+		packet.bytesCopied = packet.frame.total() * packet.frame.elemSize();
 
-		std::ofstream roisFile;
-		if (!options.roisFile.empty()){
-			roisFile.open(options.roisFile);
-			if (!roisFile.is_open())
-				throw std::runtime_error("Unable to open ROIs file.");
-			roisFile << options.input << "\n";
-			roisFile << options.label << "\n";
+		if (options.isFlipped)
+		{
+			cv::flip(packet.frame, packet.frame, 0);
+		}
+		if (options.isTransposed)
+		{
+			cv::Mat transposed = (pPool ? pPool->acquire(cv::Size(packet.frame.rows, packet.frame.cols), packet.frame.type()) : cv::Mat());
+			cv::transpose(packet.frame, transposed);
+			packet.frame = transposed;
+			packet.bytesCopied += packet.frame.total() * packet.frame.elemSize();
 		}
+	}
 
+	/// Writes the header of a ROIs file
+	/// @param[in] roisFile output stream
+	/// @param[in] input name of the input the ROIs are detected in
+	/// @param[in] label label of the ROIs
+	void writeRoisHeader(std::ostream& roisFile, const std::string& input, const std::string& label)
+	{
+		roisFile << input << "\n";
+		roisFile << label << "\n";
+	}
 
-		while (vc.read(frame))
+	/// Writes the detections of a frame to a ROIs file. The first frame is preceded by the frame size.
+	/// The detections of frames skipped by the stride are followed by "interpolated".
+	/// @param[in] roisFile output stream
+	/// @param[in] packet processed frame
+	/// @param[in] label label of the ROIs
+	void writeRois(std::ostream& roisFile, const FramePacket& packet, const std::string& label)
+	{
+		if (packet.frameno == 1)
+			roisFile << packet.inputSize.height << " " << packet.inputSize.width << "\n";
+
+		for (const auto& res : packet.result)
 		{
-			++frameno;
+			roisFile << packet.frameno << " " << res.roi.tl().x << " " << res.roi.tl().y << " " << res.roi.br().x << " " << res.roi.br().y
+				<< " " << res.roi.area() << " " << res.confidence << " " << label << (packet.isInterpolated ? " interpolated\n" : "\n");
+		}
+	}
 
-			const float scaleFactor = (float)options.maxDim / (float)std::max(frame.cols, frame.rows);
-			cv::resize(frame, frame, cv::Size(), scaleFactor, scaleFactor);
+	/// Opens a binary detection log, labelling the ROIs as in the ROIs file and the third stage outputs with their class names
+	/// @param[out] log log to open
+	/// @param[in] fileName name of the log
+	/// @param[in] options program options
+	/// @param[in] input name of the input the detections are obtained from
+	/// @param[in] model model the detections are obtained with
+	/// @param[in] frameSize size of the processed frames
+	/// @throw runtime_error if the log cannot be created
+	void openLog(DetectionLogWriter& log, const std::string& fileName, const Options& options, const std::string& input, const DetectorModel& model, const cv::Size& frameSize)
+	{
+		DetectionLogHeader header;
+		header.input = input;
+		header.frameSize = frameSize;
+		header.configHash = hashFile(options.configFile);
+		header.labels.push_back(std::make_pair(0, options.label));
+		if (model.params().useThreeStages())
+		{
+			header.labels.push_back(std::make_pair(-1, model.params().labels.at(0)));
+			header.labels.push_back(std::make_pair(1, model.params().labels.at(1)));
+		}
+		log.open(fileName, header);
+	}
 
-			if ((frameno == 1) && roisFile.is_open())
-				roisFile << frame.size().height << " " << frame.size().width << "\n";
+	/// Appends the detections of a frame to a binary detection log
+	/// @param[in,out] log open log
+	/// @param[in] packet processed frame
+	void writeLog(DetectionLogWriter& log, const FramePacket& packet)
+	{
+		for (const auto& res : packet.result)
+		{
+			log.write({ (std::uint32_t)packet.frameno, res.trackId, res.roi, (float)res.confidence, res.iLabel,
+				(std::uint32_t)(packet.isInterpolated ? DetectionRecord::INTERPOLATED : DetectionRecord::NONE) });
+		}
+	}
 
-			if (!vw.isOpened() && !options.output.empty())
+	/// Interpolates the detections of a frame skipped between two detected frames. The detections of a track move linearly
+	/// from one frame to the other, and the untracked ones are taken from the nearest detected frame.
+	/// @param[in] first detections of the detected frame before
+	/// @param[in] last detections of the detected frame after
+	/// @param[in] t position of the skipped frame between the two, in (0, 1)
+	/// @return the interpolated detections, sorted by decreasing confidence
+	std::vector<ObjDetector::DetectionInfo> interpolateDetections(const std::vector<ObjDetector::DetectionInfo>& first, const std::vector<ObjDetector::DetectionInfo>& last, double t)
+	{
+		auto findTrack = [](const std::vector<ObjDetector::DetectionInfo>& detections, TrackTable::TrackId trackId)
+		{
+			return std::find_if(detections.begin(), detections.end(), [trackId](const ObjDetector::DetectionInfo& det){ return (0 != trackId) && (det.trackId == trackId); });
+		};
+		std::vector<ObjDetector::DetectionInfo> result;
+		for (const auto& det : first)
+		{
+			const auto it = findTrack(last, det.trackId);
+			if (it == last.end())
 			{
-				std::cerr << "Saving output frames to video: " << options.output << std::endl;
-				vw.open(options.output, CV_FOURCC('M', 'P', 'E', 'G'), 30, frame.size());
+				if (t < .5)
+					result.push_back(det);
+				continue;
 			}
+			ObjDetector::DetectionInfo interpolated = det;
+			interpolated.roi = cv::Rect(cvRound(det.roi.x + t * (it->roi.x - det.roi.x)), cvRound(det.roi.y + t * (it->roi.y - det.roi.y)),
+				cvRound(det.roi.width + t * (it->roi.width - det.roi.width)), cvRound(det.roi.height + t * (it->roi.height - det.roi.height)));
+			interpolated.confidence = det.confidence + t * (it->confidence - det.confidence);
+			result.push_back(interpolated);
+		}
+		for (const auto& det : last)
+		{
+			if ((t >= .5) && (findTrack(first, det.trackId) == first.end()))
+				result.push_back(det);
+		}
+		std::sort(result.begin(), result.end(), [](const ObjDetector::DetectionInfo& res1, const ObjDetector::DetectionInfo& res2){ return res1.confidence > res2.confidence; });
+		return result;
+	}
+
+	/** @class SkippedFrames
+	*   @brief Fills in the results of the frames skipped by the stride.
+	*   @details With tracking, the detections of the last detected frame are tracked through the skipped frames as they come.
+	*	Otherwise the skipped frames are held until the next detected frame, and their results are interpolated between the two.
+	*	Either way, the packets come out in input order.
+	*/
+	class SkippedFrames
+	{
+	public:
+		/// Ctor
+		/// @param[in] doTrack whether the skipped frames are retrieved and the detections tracked through them
+		explicit SkippedFrames(bool doTrack) : doTrack_(doTrack), lastFrameno_(0), lastFps_(0.) {}
 
-			if (options.isFlipped)
+		/// Takes a detected frame
+		/// @param[in] packet detected frame and its results
+		/// @return the held skipped frames, with their interpolated results, to be output before packet
+		std::vector<FramePacket> addDetected(const FramePacket& packet)
+		{
+			std::vector<FramePacket> ready;
+			ready.swap(held_);
+			for (auto& skipped : ready)
 			{
-				cv::flip(frame, frame, 0);
+				skipped.result = interpolateDetections(lastResult_, packet.result, (double)(skipped.frameno - lastFrameno_) / (packet.frameno - lastFrameno_));
+				skipped.fps = packet.fps;
 			}
-			if (options.isTransposed)
+			lastFrameno_ = packet.frameno;
+			lastResult_ = packet.result;
+			lastFps_ = packet.fps;
+			if (doTrack_)
+				cv::cvtColor(packet.frame, prevGray_, CV_BGR2GRAY);
+			return ready;
+		}
+
+		/// Takes a skipped frame
+		/// @param[in] packet skipped frame, retrieved and preprocessed if tracking
+		/// @return the skipped frames whose results are known, possibly none
+		std::vector<FramePacket> addSkipped(FramePacket packet)
+		{
+			std::vector<FramePacket> ready;
+			if (!doTrack_)
 			{
-				frame = frame.t();
+				held_.push_back(std::move(packet));
+				return ready;
 			}
-
-			// Run detector
-			auto result = detector.detect(frame, fps, options.doTrack);
-			if (!options.patchPrefix.empty())
+			if (packet.frame.size() != prevGray_.size())	//the detector may rescale the frames it processes
 			{
-				detector.dumpStage2(options.patchPrefix);
+				cv::Mat resized;
+				cv::resize(packet.frame, resized, prevGray_.size());
+				packet.frame = resized;
 			}
-			putText(detector.currFrame, "FPS: " + std::to_string(fps), cv::Point(100, detector.currFrame.size().height - 100), CV_FONT_HERSHEY_PLAIN, 1.0, COLOR_BLUE);
-			if (options.doShowIntermediate)
+			cv::cvtColor(packet.frame, gray_, CV_BGR2GRAY);
+			for (std::size_t i = 0; i < lastResult_.size();)
 			{
-				//plot and write confidence and size of stage 1
-				auto rois1 = detector.getStage1Rois();
-				for (const auto& res : rois1)
+				lastResult_[i].roi = trackMedianFlow(lastResult_[i].roi, prevGray_, gray_);
+				if (0 == lastResult_[i].roi.area())	//lost until the next detected frame
 				{
-					cv::rectangle(detector.currFrame, res, COLOR_CASCADE_DETECTION, 1);
-					putText(detector.currFrame, to_string(res.size()), res.tl(), CV_FONT_HERSHEY_PLAIN, 1.0, COLOR_CASCADE_DETECTION);
+					lastResult_.erase(lastResult_.begin() + i);
+					continue;
 				}
+				++i;
+			}
+			cv::swap(prevGray_, gray_);
+			packet.result = lastResult_;
+			packet.fps = lastFps_;
+			ready.push_back(std::move(packet));
+			return ready;
+		}
+
+		/// @return the skipped frames still held at the end of the stream, with the results of the last detected frame
+		std::vector<FramePacket> flush()
+		{
+			std::vector<FramePacket> ready;
+			ready.swap(held_);
+			for (auto& skipped : ready)
+			{
+				skipped.result = lastResult_;
+				skipped.fps = lastFps_;
+			}
+			return ready;
+		}
+
+	private:
+		bool doTrack_;                                          //< whether the detections are tracked through the skipped frames
+		int lastFrameno_;                                       //< index of the last detected frame
+		double lastFps_;                                        //< frame rate of the detector at the last detected frame
+		std::vector<ObjDetector::DetectionInfo> lastResult_;    //< results of the last detected frame, then of the last tracked one
+		std::vector<FramePacket> held_;                         //< skipped frames waiting for the next detected frame
+		cv::Mat prevGray_;                                      //< grayscale version of the last frame with results, when tracking
+		cv::Mat gray_;                                          //< grayscale version of the skipped frame being tracked
+	};
+
+	/// Reports the outcome of a model reload
+	/// @param[in] model reloaded model, null if the reload failed
+	/// @param[in] error reason of the failure
+	void reportReload(std::shared_ptr<const DetectorModel> model, const std::string& error)
+	{
+		if (model)
+			std::clog << "Reloaded " << model->params().configFileName << std::endl;
+		else
+			std::cerr << "Reload failed, keeping the previous model: " << error << std::endl;
+	}
+
+	/// Prints how often a detector missed its real-time deadline
+	/// @param[in] out output stream
+	/// @param[in] detector detector
+	void printDeadlineStats(std::ostream& out, const ObjDetector& detector)
+	{
+		const auto stats = detector.getDeadlineStats();
+		if (0 == stats.nFrames)
+			return;
+		out << "Deadline missed in " << stats.nMissed << " of " << stats.nFrames << " frames ("
+			<< (100. * stats.nMissed / stats.nFrames) << "%), highest degradation level " << stats.maxLevelReached << std::endl;
+	}
 
-				//plot and write confidence and size of stage 2
-				auto rois2 = detector.getStage2Rois();
-				for (const auto& res : rois2)
+	/// Prints the allocation counters of a buffer pool
+	/// @param[in] out output stream
+	/// @param[in] name what the buffers are used for
+	/// @param[in] stats allocation counters
+	void printBufferStats(std::ostream& out, const std::string& name, const BufferPool::Stats& stats)
+	{
+		if (0 == stats.nRequests)
+			return;
+		out << name << " buffers: " << stats.nAllocations << " allocated for " << stats.nRequests << " frames ("
+			<< stats.bytesAllocated << " bytes), " << stats.nBuffers << " kept (" << stats.bytesHeld << " bytes)" << std::endl;
+	}
+
+	/// Derives the name of the output file of one of several streams, by appending the stream index to the stem
+	/// @param[in] fileName output file name given on the command line
+	/// @param[in] index index of the stream
+	/// @return fileName with "_<index>" inserted before the extension
+	std::string streamFileName(const std::string& fileName, std::size_t index)
+	{
+		const std::size_t dot = fileName.find_last_of('.');
+		const std::size_t sep = fileName.find_last_of("/\\");
+		const bool hasExtension = (dot != std::string::npos) && ((sep == std::string::npos) || (dot > sep));
+		const std::string suffix = "_" + std::to_string(index);
+		return (hasExtension ? fileName.substr(0, dot) + suffix + fileName.substr(dot) : fileName + suffix);
+	}
+
+	/// Processes a whole stream headless, serially, with its own detector state
+	/// @param[in] options program options
+	/// @param[in] input name of the input
+	/// @param[in] model model shared by all streams
+	/// @param[in] pWatcher if not null, the stream switches to the models it reloads
+	/// @param[in] roisFileName if non-empty, the detections are saved to this file
+	/// @param[in] binLogFileName if non-empty, the detections are saved to a binary log with this name
+	/// @return the per-stage latencies and counters of the stream
+	/// @throw runtime_error if the input or the output cannot be opened, or the detection fails
+	DetectionStats processStream(const Options& options, const std::string& input, std::shared_ptr<const DetectorModel> model, const ModelWatcher* pWatcher, const std::string& roisFileName, const std::string& binLogFileName)
+	{
+		ObjDetector detector(model);
+		if (options.deadline >= 0.)
+			detector.setDeadline(options.deadline);
+		cv::VideoCapture vc = openInput(input, options.maxDim);
+
+		std::ofstream roisFile;
+		if (!roisFileName.empty())
+		{
+			roisFile.open(roisFileName);
+			if (!roisFile.is_open())
+				throw std::runtime_error("Unable to open ROIs file " + roisFileName);
+			writeRoisHeader(roisFile, input, options.label);
+		}
+
+		DetectionLogWriter log;	//opened on the first frame, once the frame size is known
+
+		auto output = [&](const FramePacket& packet)
+		{
+			if (roisFile.is_open())
+				writeRois(roisFile, packet, options.label);
+			if (!binLogFileName.empty())
+			{
+				if (!log.isOpen())
+					openLog(log, binLogFileName, options, input, *detector.getModel(), packet.inputSize);
+				writeLog(log, packet);
+			}
+		};
+
+		cv::Mat frame;
+		FramePacket packet;
+		packet.frameno = 0;
+		packet.isInterpolated = false;
+		SkippedFrames skippedFrames(options.doStrideTracking);
+		BufferPool framePool(3);	//the previous frame is still referenced by the packet and the detector while the next one is preprocessed, and a skipped one may be tracked
+		int frameno = 0;
+		while (vc.grab())	//grab() decodes every frame; the frames skipped by the stride save retrieve(), the resize and the detection, unless they are tracked
+		{
+			++frameno;
+			if (0 != (frameno - 1) % options.stride)
+			{
+				FramePacket skipped;
+				skipped.frameno = frameno;
+				skipped.bytesCopied = 0;
+				skipped.isInterpolated = true;
+				if (options.doStrideTracking)
 				{
-					cv::rectangle(detector.currFrame, res.roi, COLOR_CANDIDATE, 1);
-					putText(detector.currFrame, to_string(res.roi.size()), res.roi.tl(), CV_FONT_HERSHEY_PLAIN, 1.0, COLOR_CASCADE_DETECTION);
+					if (!vc.retrieve(frame))
+						break;
+					preprocess(frame, options, skipped, &framePool);
 				}
+				for (const auto& ready : skippedFrames.addSkipped(std::move(skipped)))
+					output(ready);
+				continue;
+			}
+			if (!vc.retrieve(frame))
+				break;
+			packet.frameno = frameno;
+			preprocess(frame, options, packet, &framePool);
+			if (pWatcher && (pWatcher->model() != detector.getModel()))
+				detector.setModel(pWatcher->model());
+			packet.result = detector.detect(packet.frame, packet.fps, options.doTrack);
+			for (const auto& ready : skippedFrames.addDetected(packet))
+				output(ready);
+			output(packet);
+		}
+		for (const auto& ready : skippedFrames.flush())
+			output(ready);
+		log.close();
+		printDeadlineStats(std::clog, detector);
+		return detector.getStats();
+	}
+
+	/// Reads a list of inputs, one per line. Trailing blanks and empty lines are ignored.
+	/// @param[in] fileName name of the list
+	/// @return the listed inputs
+	/// @throw runtime_error if the list cannot be opened
+	std::vector<std::string> readList(const std::string& fileName)
+	{
+		std::ifstream listFile(fileName);
+		if (!listFile.is_open())
+			throw std::runtime_error("Unable to open input list " + fileName);
+		std::vector<std::string> inputs;
+		std::string line;
+		while (std::getline(listFile, line))
+		{
+			line.erase(line.find_last_not_of(" \t\r") + 1);
+			if (!line.empty())
+				inputs.push_back(line);
+		}
+		return inputs;
+	}
+
+	/// Processes the inputs listed in a file concurrently, sharing a single model
+	/// @param[in] options program options
+	/// @return true if all inputs were processed successfully
+	/// @throw runtime_error if the list or the model cannot be loaded
+	bool processStreams(const Options& options)
+	{
+		const std::vector<std::string> inputs = readList(options.inputList);
+
+		auto model = std::make_shared<const DetectorModel>(options.configFile);
+		std::unique_ptr<ModelWatcher> pWatcher;	//outlives the workers
+		if (options.watchPeriod > 0)
+			pWatcher.reset(new ModelWatcher(options.configFile, std::string(), model, reportReload, options.watchPeriod));
+		const ModelWatcher* pStreamWatcher = pWatcher.get();
+		ThreadPool workers(options.nJobs);
+		std::vector<std::future<DetectionStats>> results;
+		for (std::size_t k = 0; k < inputs.size(); ++k)
+		{
+			const std::string roisFileName = (options.roisFile.empty() ? std::string() : streamFileName(options.roisFile, k));
+			const std::string binLogFileName = (options.binLogFile.empty() ? std::string() : streamFileName(options.binLogFile, k));
+			const std::string& input = inputs[k];
+			results.push_back(workers.submit([&options, &input, model, pStreamWatcher, roisFileName, binLogFileName]()
+			{
+				return processStream(options, input, model, pStreamWatcher, roisFileName, binLogFileName);
+			}));
+		}
+
+		bool isSuccessful = true;
+		DetectionStats totalStats;
+		for (std::size_t k = 0; k < inputs.size(); ++k)
+		{
+			try
+			{
+				const DetectionStats stats = results[k].get();
+				std::clog << "[" << k << "] " << inputs[k] << ": " << stats.nFrames << " frames" << std::endl;
+				totalStats.merge(stats);
 			}
-			//plotting detections and confidence values
-			cv::Mat tmpFrame;
-			detector.currFrame.copyTo(tmpFrame);
-			for (const auto& res : result)
+			catch (std::exception& err)
 			{
-				if (res.iLabel != 0){
-					if (res.iLabel == -1)
-						cv::rectangle(tmpFrame, res.roi, cv::Scalar(0, 0, 255), 2);
-					else
-						cv::rectangle(tmpFrame, res.roi, cv::Scalar(255, 0, 0), 2);
-				}
-				else cv::rectangle(tmpFrame, res.roi, COLOR_VERIFIED_SIGN, 2);
+				std::cerr << "[" << k << "] " << inputs[k] << ": " << err.what() << std::endl;
+				isSuccessful = false;
+			}
+		}
+		std::clog << "Detection statistics over all streams:" << std::endl;
+		totalStats.print(std::clog);
+		return isSuccessful;
+	}
 
-				if (res.iLabel != 0)
-					putText(tmpFrame, res.sLabel, res.roi.tl(), CV_FONT_HERSHEY_PLAIN, 1.0, COLOR_RED);
-				else
-					putText(tmpFrame, to_string(res.roi.size()), res.roi.tl(), CV_FONT_HERSHEY_PLAIN, 1.0, COLOR_VERIFIED_SIGN);
-				putText(tmpFrame, "p=" + std::to_string(res.confidence), res.roi.br(), CV_FONT_HERSHEY_PLAIN, 1.0, COLOR_VERIFIED_SIGN);
+	/// Processes still images independently, in parallel, without tracking. Images are loaded and detected in chunks,
+	/// so that memory use does not depend on the number of images.
+	/// The output lists each image as "image <index> <height> <width> <path>", followed by its detections in the format
+	/// of the ROIs file, with the image index in place of the frame number.
+	/// @param[in] options program options
+	/// @return true if all images could be read
+	/// @throw runtime_error if the list, the model or the output cannot be opened, or the detection fails
+	bool processBatch(const Options& options)
+	{
+		std::vector<std::string> files;
+		struct stat st;
+		if ((0 == stat(options.batch.c_str(), &st)) && (st.st_mode & S_IFDIR))
+			cv::glob(options.batch, files, false);
+		else
+			files = readList(options.batch);
+
+		const ObjDetector detector(options.configFile);
+		const unsigned int nThreads = (options.nJobs > 0 ? (unsigned int)options.nJobs : std::max(1u, std::thread::hardware_concurrency()));
+		std::unique_ptr<ThreadPool> pPool(nThreads > 1 ? new ThreadPool(nThreads - 1) : nullptr);	//the calling thread takes part
+		auto forEach = [&pPool](std::size_t n, const std::function<void(std::size_t)>& fn)
+		{
+			if (pPool)
+				pPool->parallelFor(n, fn);
+			else
+				for (std::size_t i = 0; i < n; ++i)
+					fn(i);
+		};
+
+		std::ofstream outFile;
+		if (!options.roisFile.empty())
+		{
+			outFile.open(options.roisFile);
+			if (!outFile.is_open())
+				throw std::runtime_error("Unable to open ROIs file " + options.roisFile);
+		}
+		std::ostream& out = (outFile.is_open() ? outFile : std::cout);
+		writeRoisHeader(out, options.batch, options.label);
 
-				if (!options.roisFile.empty()){
-					roisFile << frameno << " " << res.roi.tl().x << " " << res.roi.tl().y << " " << res.roi.br().x << " " << res.roi.br().y
+		static const std::size_t IMAGES_PER_THREAD = 32;	//chunk size, per thread
+		const std::size_t chunkSize = IMAGES_PER_THREAD * nThreads;
+		std::vector<FramePacket> packets;
+		std::vector<cv::Mat> images;
+		std::size_t nFailed = 0;
+		for (std::size_t first = 0; first < files.size(); first += chunkSize)
+		{
+			const std::size_t n = std::min(chunkSize, files.size() - first);
+			packets.assign(n, FramePacket());
+			images.assign(n, cv::Mat());
+			forEach(n, [&](std::size_t i)	//decoding dominates for large photos, so it is parallel too
+			{
+				FramePacket& packet = packets[i];
+				packet.frameno = (int)(first + i + 1);
+				const cv::Mat image = cv::imread(files[first + i]);
+				if (image.empty())
+					return;
+				preprocess(image, options, packet);
+				images[i] = packet.frame;
+			});
+			const auto results = detector.detectBatch(images, pPool.get());
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				FramePacket& packet = packets[i];
+				if (images[i].empty())
+				{
+					std::cerr << "Unable to read image " << files[first + i] << std::endl;
+					++nFailed;
+				}
+				out << "image " << packet.frameno << " " << images[i].rows << " " << images[i].cols << " " << files[first + i] << "\n";
+				for (const auto& res : results[i])
+				{
+					out << packet.frameno << " " << res.roi.tl().x << " " << res.roi.tl().y << " " << res.roi.br().x << " " << res.roi.br().y
 						<< " " << res.roi.area() << " " << res.confidence << " " << options.label << "\n";
 				}
 			}
-			cv::imshow("Detection", tmpFrame);
-			if (options.doSaveFrames)
-			{
-				//add leading zeros to frameno
-				std::string fn;
-				if (frameno < 10)
-					fn = "000";
-				else if (frameno < 100)
-					fn = "00";
-				else if (frameno < 1000)
-					fn = "0";
-				fn = fn + std::to_string(frameno);
-				cv::imwrite(std::string("frame_" + fn + ".png"), tmpFrame);
+		}
+		out.flush();
+		std::clog << files.size() << " images processed, " << nFailed << " could not be read" << std::endl;
+		return (0 == nFailed);
+	}
+
+	/// Draws the frame rate, the intermediate results if available, and the detections on the frame of a packet
+	/// @param[in,out] packet processed frame and its detections
+	void annotate(FramePacket& packet)
+	{
+		cv::Mat& frame = packet.frame;	//owned by the packet, safe to draw on
+		putText(frame, "FPS: " + std::to_string(packet.fps), cv::Point(100, frame.size().height - 100), CV_FONT_HERSHEY_PLAIN, 1.0, COLOR_BLUE);
+
+		//plot and write confidence and size of stage 1
+		for (const auto& res : packet.stage1Rois)
+		{
+			cv::rectangle(frame, res, COLOR_CASCADE_DETECTION, 1);
+			putText(frame, to_string(res.size()), res.tl(), CV_FONT_HERSHEY_PLAIN, 1.0, COLOR_CASCADE_DETECTION);
+		}
+
+		//plot and write confidence and size of stage 2
+		for (const auto& res : packet.stage2Rois)
+		{
+			cv::rectangle(frame, res.roi, COLOR_CANDIDATE, 1);
+			putText(frame, to_string(res.roi.size()), res.roi.tl(), CV_FONT_HERSHEY_PLAIN, 1.0, COLOR_CASCADE_DETECTION);
+		}
+
+		//plotting detections and confidence values
+		for (const auto& res : packet.result)
+		{
+			if (res.iLabel != 0){
+				if (res.iLabel == -1)
+					cv::rectangle(frame, res.roi, cv::Scalar(0, 0, 255), 2);
+				else
+					cv::rectangle(frame, res.roi, cv::Scalar(255, 0, 0), 2);
 			}
-			keypress = cv::waitKey(1);
+			else cv::rectangle(frame, res.roi, COLOR_VERIFIED_SIGN, 2);
 
-			if (keypress == 27) //exit on escape
-				break;
+			if (res.iLabel != 0)
+				putText(frame, res.sLabel, res.roi.tl(), CV_FONT_HERSHEY_PLAIN, 1.0, COLOR_RED);
+			else
+				putText(frame, to_string(res.roi.size()), res.roi.tl(), CV_FONT_HERSHEY_PLAIN, 1.0, COLOR_VERIFIED_SIGN);
+			putText(frame, "p=" + std::to_string(res.confidence), res.roi.br(), CV_FONT_HERSHEY_PLAIN, 1.0, COLOR_VERIFIED_SIGN);
+		}
+	}
+}   //::<anon>
+
+/// Main entry point
+/// @param[in] argc number of command line arguments (including program name)
+/// @param[in] argv list of arguments
+/// @return EXIT_SUCCESS if the program completes successfully, EXIT_FAILURE if an error occurs.
+int main(int argc, char* argv[])
+{
+	try
+	{
+		auto options = parseOptions(argc, argv);
+
+		if (!options.inputList.empty())
+		{
+			return (processStreams(options) ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+		if (!options.batch.empty())
+		{
+			return (processBatch(options) ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+
+		ObjDetector detector(options.configFile);
+		if (options.deadline >= 0.)
+			detector.setDeadline(options.deadline);
+		std::unique_ptr<ModelWatcher> pWatcher;	//stops before the detector is destroyed
+		if (options.watchPeriod > 0)
+		{
+			pWatcher.reset(new ModelWatcher(options.configFile, std::string(), detector.getModel(),
+				[&detector](std::shared_ptr<const DetectorModel> model, const std::string& error)
+			{
+				reportReload(model, error);
+				if (model)
+					detector.setModel(model);
+			}, options.watchPeriod));
+		}
+
+		cv::VideoCapture vc = openInput(options.input, options.maxDim);
+
+		assert(vc.isOpened());
+		int keypress;
+		cv::VideoWriter vw;
+
+		std::ofstream roisFile;
+		if (!options.roisFile.empty()){
+			roisFile.open(options.roisFile);
+			if (!roisFile.is_open())
+				throw std::runtime_error("Unable to open ROIs file.");
+			writeRoisHeader(roisFile, options.input, options.label);
+		}
+		DetectionLogWriter binLog;	//opened on the first frame, once the frame size is known
+
+		// Frames go through three stages connected by bounded queues: capture and preprocessing, detection,
+		// and annotation and output. The last stage runs on the main thread, as HighGUI requires.
+		// Each stage handles the frames in order, so the outputs are in input order.
+		BoundedQueue<FramePacket> capturedFrames(options.queueSize), processedFrames(options.queueSize);
+		std::atomic<bool> isStopping(false);
+		std::exception_ptr captureError, detectionError;
+		//frames in flight: both queues full, plus one in each stage and the last frame kept by the detector
+		BufferPool framePool(2 * options.queueSize + 4);
+
+		//the threads are started inside the guarded region, so that a failure to start one still stops and joins the other
+		std::thread captureThread, detectionThread;
+		auto stopPipeline = [&]()
+		{
+			isStopping = true;
+			capturedFrames.close();
+			processedFrames.close();
+			if (captureThread.joinable())
+				captureThread.join();
+			if (detectionThread.joinable())
+				detectionThread.join();
+		};
+
+		int nFrames = 0;
+		double totalBytesCopied = 0.;	//image data copied over all frames
+		try
+		{
+			captureThread = std::thread([&]()
+			{
+				try
+				{
+					cv::Mat frame;
+					int frameno = 0;
+					while (!isStopping && vc.grab())
+					{
+						FramePacket packet;
+						packet.frameno = ++frameno;
+						packet.bytesCopied = 0;
+						packet.isInterpolated = (0 != (frameno - 1) % options.stride);
+						if (!packet.isInterpolated || options.doStrideTracking)	//frames skipped by the stride are only retrieved and resized to be tracked
+						{
+							if (!vc.retrieve(frame))
+								break;
+							preprocess(frame, options, packet, &framePool);
+						}
+						if (!capturedFrames.push(std::move(packet)))
+							break;
+					}
+				}
+				catch (...)
+				{
+					captureError = std::current_exception();
+				}
+				capturedFrames.close();
+			});
+
+			detectionThread = std::thread([&]()
+			{
+				try
+				{
+					FramePacket packet;
+					SkippedFrames skippedFrames(options.doStrideTracking);
+					bool isOpen = true;	//whether the output stage still takes frames
+					while (isOpen && capturedFrames.pop(packet))
+					{
+						if (packet.isInterpolated)
+						{
+							for (auto& ready : skippedFrames.addSkipped(std::move(packet)))
+								isOpen = isOpen && processedFrames.push(std::move(ready));
+							continue;
+						}
+						// Run detector
+						packet.result = detector.detect(packet.frame, packet.fps, options.doTrack);
+						packet.bytesCopied += detector.getBytesCopied();
+						if (!options.patchPrefix.empty())
+						{
+							detector.dumpStage2(options.patchPrefix);
+						}
+						if (options.doShowIntermediate)
+						{
+							packet.stage1Rois = detector.getStage1Rois();
+							packet.stage2Rois = detector.getStage2Rois();
+						}
+						for (auto& ready : skippedFrames.addDetected(packet))
+							isOpen = isOpen && processedFrames.push(std::move(ready));
+						isOpen = isOpen && processedFrames.push(std::move(packet));
+					}
+					for (auto& ready : skippedFrames.flush())
+						isOpen = isOpen && processedFrames.push(std::move(ready));
+				}
+				catch (...)
+				{
+					detectionError = std::current_exception();
+					isStopping = true;
+					capturedFrames.close();
+				}
+				processedFrames.close();
+			});
+
+			FramePacket packet;
+			while (processedFrames.pop(packet))
+			{
+				++nFrames;
+				totalBytesCopied += packet.bytesCopied;
+				const int frameno = packet.frameno;
+
+				if (roisFile.is_open())
+					writeRois(roisFile, packet, options.label);
+				if (!options.binLogFile.empty())
+				{
+					if (!binLog.isOpen())
+						openLog(binLog, options.binLogFile, options, options.input, *detector.getModel(), packet.inputSize);
+					writeLog(binLog, packet);
+				}
+
+				if (options.isHeadless || packet.frame.empty())	//frames skipped by the stride have no image unless they are tracked
+					continue;
+
+				if (!vw.isOpened() && !options.output.empty())
+				{
+					std::cerr << "Saving output frames to video: " << options.output << std::endl;
+					vw.open(options.output, CV_FOURCC('M', 'P', 'E', 'G'), 30, packet.inputSize);
+				}
+
+				annotate(packet);
+				cv::imshow("Detection", packet.frame);
+				if (options.doSaveFrames)
+				{
+					//add leading zeros to frameno
+					std::string fn;
+					if (frameno < 10)
+						fn = "000";
+					else if (frameno < 100)
+						fn = "00";
+					else if (frameno < 1000)
+						fn = "0";
+					fn = fn + std::to_string(frameno);
+					cv::imwrite(std::string("frame_" + fn + ".png"), packet.frame);
+				}
+				keypress = cv::waitKey(1);
+
+				if (keypress == 27) //exit on escape
+					break;
+			}
 		}
+		catch (...)
+		{
+			stopPipeline();
+			throw;
+		}
+		stopPipeline();
+		binLog.close();
+		if (captureError)
+			std::rethrow_exception(captureError);
+		if (detectionError)
+			std::rethrow_exception(detectionError);
+
+		if (nFrames > 0)
+			std::clog << "Image data copied per frame: " << (std::size_t)(totalBytesCopied / nFrames) << " bytes" << std::endl;
+		const auto verificationStats = detector.getVerificationStats();
+		std::clog << "Tracked object verifications: " << verificationStats.nRun << " run, " << verificationStats.nSkipped << " skipped" << std::endl;
+		printDeadlineStats(std::clog, detector);
+		printBufferStats(std::clog, "Input frame", framePool.getStats());
+		printBufferStats(std::clog, "Rescaled frame", detector.getBufferStats());
+		std::clog << "Detection statistics:" << std::endl;
+		detector.getStats().print(std::clog);
 		return EXIT_SUCCESS;
 	}
 	catch (std::exception& err)
@@ -0,0 +1,386 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "DetectionStats.h"
+#include "ObjDetector.h"
+#include "ThreadPool.h"
+#include "version.h"
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+	/// Parameters and command line arguments
+	struct Options
+	{
+		std::string configFile;         //< The configuration file in YAML format
+		std::string input;              //< if non-empty, video whose frames are decoded ahead of the benchmark
+		std::string cropsDir;           //< if non-empty, directory of sign crops pasted onto the synthetic frames
+		std::string backgroundsDir;     //< if non-empty, directory of background images for the synthetic frames
+		std::string output;             //< if non-empty, the report is written to this file instead of the standard output
+		int nFrames;                    //< number of frames per stream
+		int maxDim;                     //< maximum dimension of the frames in pixels
+		int nStreams;                   //< number of streams of the multi-stream runs
+		int nJobs;                      //< number of threads of the multi-stream runs (0: one per hardware thread)
+		int seed;                       //< seed of the synthetic frame generator
+	};
+
+	/// Prints basic usage to terminal
+	inline void printUsage()
+	{
+		std::cerr << "USAGE: signfinder_bench -c configfile [-i video | [-C cropsDir] [-B backgroundsDir]] [-n frames] [-m maxdim] [-s streams] [-j jobs] [-o report.json]" << std::endl;
+	}
+
+	/// Parses command line options
+	/// @param[in] argc number of command line arguments (including program name)
+	/// @param[in] argv list of arguments
+	/// @return an options structure populated by parsing the command line
+	/// @throw runtime_error if there was a problem parsing the command line arguments
+	Options parseOptions(int argc, char* argv[]) throw(std::runtime_error)
+	{
+		const char* keys =
+		{
+			"{ h | help            | false       | print this message                                            }"
+			"{ c | configFile      |             | location of config file                                       }"
+			"{ i | input           |             | video decoded ahead of the benchmark. If none, frames are synthesized}"
+			"{ C | crops           |             | directory of sign crops pasted onto synthetic frames. If none, signs are drawn}"
+			"{ B | backgrounds     |             | directory of background images for synthetic frames. If none, noise is used}"
+			"{ n | frames          | 300         | number of frames per stream                                   }"
+			"{ m | maxdim          | 640         | maximum dimension of the frames                               }"
+			"{ s | streams         | 4           | number of streams of the multi-stream runs                    }"
+			"{ j | jobs            | 0           | number of threads of the multi-stream runs (0: one per hardware thread)}"
+			"{ r | seed            | 1           | seed of the synthetic frame generator                         }"
+			"{ o | output          |             | writes the JSON report to this file instead of the standard output}"
+		};
+		cv::CommandLineParser parser(argc, argv, keys);
+		if ((1 == argc) || (parser.get<bool>("h")))
+		{
+			printUsage();
+			parser.printParams();
+			std::cout << "SignFinder v" << SIGNFINDER_VERSION << std::endl;
+			exit(EXIT_SUCCESS);
+		}
+
+		Options opts;
+		opts.configFile = parser.get<std::string>("c");
+		if (opts.configFile.empty())
+		{
+			printUsage();
+			throw std::runtime_error("Parser Error :: No configuration file specified.");
+		}
+		opts.input = parser.get<std::string>("i");
+		opts.cropsDir = parser.get<std::string>("C");
+		opts.backgroundsDir = parser.get<std::string>("B");
+		opts.output = parser.get<std::string>("o");
+		opts.nFrames = parser.get<int>("n");
+		opts.maxDim = parser.get<int>("m");
+		opts.nStreams = parser.get<int>("s");
+		opts.nJobs = parser.get<int>("j");
+		opts.seed = parser.get<int>("r");
+		if ((opts.nFrames < 1) || (opts.maxDim < 16) || (opts.nStreams < 1) || (opts.nJobs < 0))
+		{
+			throw std::runtime_error("Parser Error :: frames and streams must be at least 1, maxdim at least 16, and jobs not negative");
+		}
+		return opts;
+	}
+
+	/// @return the peak resident set size of the process in kilobytes, 0 if unavailable
+	long peakRssKB()
+	{
+#ifndef _WIN32
+		rusage usage;
+		if (0 == getrusage(RUSAGE_SELF, &usage))
+		{
+#ifdef __APPLE__
+			return usage.ru_maxrss / 1024;	//bytes on OS X
+#else
+			return usage.ru_maxrss;
+#endif
+		}
+#endif
+		return 0;
+	}
+
+	/// Loads all the images of a directory
+	/// @param[in] dir directory
+	/// @return the loaded images
+	/// @throw runtime_error if no image can be loaded
+	std::vector<cv::Mat> loadImages(const std::string& dir)
+	{
+		std::vector<std::string> fileNames;
+		cv::glob(dir, fileNames);
+		std::vector<cv::Mat> images;
+		for (const auto& fileName : fileNames)
+		{
+			cv::Mat image = cv::imread(fileName);
+			if (!image.empty())
+				images.push_back(image);
+		}
+		if (images.empty())
+			throw std::runtime_error("No image found in " + dir);
+		return images;
+	}
+
+	/// Decodes the first frames of a video, resized to the benchmark size
+	/// @param[in] options benchmark options
+	/// @return the decoded frames
+	/// @throw runtime_error if the video cannot be opened or is empty
+	std::vector<cv::Mat> decodeFrames(const Options& options)
+	{
+		cv::VideoCapture vc(options.input);
+		if (!vc.isOpened())
+			throw std::runtime_error("Unable to open video file " + options.input);
+		std::vector<cv::Mat> frames;
+		cv::Mat frame;
+		while (((int)frames.size() < options.nFrames) && vc.read(frame))
+		{
+			const float scaleFactor = (float)options.maxDim / (float)std::max(frame.cols, frame.rows);
+			cv::Mat resized;
+			cv::resize(frame, resized, cv::Size(), scaleFactor, scaleFactor);
+			frames.push_back(resized);
+		}
+		if (frames.empty())
+			throw std::runtime_error("No frame decoded from " + options.input);
+		return frames;
+	}
+
+	/// Draws a sign-like patch: white text on a green plate, as a stand-in when no crops are given
+	/// @return the patch
+	cv::Mat drawSign()
+	{
+		cv::Mat sign(60, 120, CV_8UC3, cv::Scalar(40, 140, 20));
+		cv::rectangle(sign, cv::Rect(3, 3, 114, 54), cv::Scalar(255, 255, 255), 2);
+		cv::putText(sign, "EXIT", cv::Point(14, 45), CV_FONT_HERSHEY_SIMPLEX, 1.4, cv::Scalar(255, 255, 255), 3);
+		return sign;
+	}
+
+	/// Synthesizes a clip: a few signs moving at constant velocity over a background, so that tracking has work to do
+	/// @param[in] options benchmark options
+	/// @return the synthesized frames
+	std::vector<cv::Mat> synthesizeFrames(const Options& options)
+	{
+		cv::RNG rng(options.seed);
+		const cv::Size frameSize(options.maxDim, options.maxDim * 3 / 4);
+		const std::vector<cv::Mat> crops = (options.cropsDir.empty() ? std::vector<cv::Mat>(1, drawSign()) : loadImages(options.cropsDir));
+
+		cv::Mat background;
+		if (options.backgroundsDir.empty())	//smooth noise
+		{
+			cv::Mat noise(frameSize.height / 16, frameSize.width / 16, CV_8UC3);
+			rng.fill(noise, cv::RNG::UNIFORM, 0, 256);
+			cv::resize(noise, background, frameSize, 0, 0, cv::INTER_CUBIC);
+		}
+		else
+		{
+			const std::vector<cv::Mat> backgrounds = loadImages(options.backgroundsDir);
+			cv::resize(backgrounds[rng.uniform(0, (int)backgrounds.size())], background, frameSize);
+		}
+
+		struct MovingSign
+		{
+			cv::Mat patch;
+			cv::Point2f position;
+			cv::Point2f velocity;
+		};
+		std::vector<MovingSign> signs;
+		for (int k = 0; k < 3; ++k)
+		{
+			const cv::Mat& crop = crops[rng.uniform(0, (int)crops.size())];
+			const int width = rng.uniform(frameSize.width / 12, frameSize.width / 5);
+			MovingSign s;
+			cv::resize(crop, s.patch, cv::Size(width, std::max(1, width * crop.rows / crop.cols)));
+			s.position = cv::Point2f(rng.uniform(0.f, (float)(frameSize.width - s.patch.cols)), rng.uniform(0.f, (float)(frameSize.height - s.patch.rows)));
+			s.velocity = cv::Point2f(rng.uniform(-3.f, 3.f), rng.uniform(-2.f, 2.f));
+			signs.push_back(s);
+		}
+
+		std::vector<cv::Mat> frames;
+		for (int i = 0; i < options.nFrames; ++i)
+		{
+			cv::Mat frame = background.clone();
+			for (auto& s : signs)
+			{
+				const cv::Point maxPos(frameSize.width - s.patch.cols, frameSize.height - s.patch.rows);
+				if ((s.position.x < 0) || (s.position.x > maxPos.x))
+					s.velocity.x = -s.velocity.x;
+				if ((s.position.y < 0) || (s.position.y > maxPos.y))
+					s.velocity.y = -s.velocity.y;
+				s.position += s.velocity;
+				const cv::Point tl(std::min(std::max(0, cvRound(s.position.x)), maxPos.x), std::min(std::max(0, cvRound(s.position.y)), maxPos.y));
+				s.patch.copyTo(frame(cv::Rect(tl, s.patch.size())));
+			}
+			frames.push_back(frame);
+		}
+		return frames;
+	}
+
+	/// Runs one detector over all the frames
+	/// @param[in] model shared model
+	/// @param[in] frames frames to process
+	/// @param[in] doTrack whether to use tracking
+	/// @return the statistics of the detector
+	DetectionStats runStream(std::shared_ptr<const DetectorModel> model, const std::vector<cv::Mat>& frames, bool doTrack)
+	{
+		ObjDetector detector(model);
+		for (const auto& f : frames)
+		{
+			cv::Mat frame = f;	//detect() may rescale its input, which only replaces this header
+			detector.detect(frame, doTrack);
+		}
+		return detector.getStats();
+	}
+
+	/// Result of a benchmark run
+	struct RunResult
+	{
+		std::string name;       //< name of the run
+		int nStreams;           //< number of concurrent streams
+		bool doTrack;           //< whether tracking was used
+		double wallSeconds;     //< wall time of the run
+		DetectionStats stats;   //< statistics merged over the streams
+		long peakRssKB;         //< peak resident set size of the process at the end of the run
+	};
+
+	/// Runs a benchmark configuration
+	/// @param[in] name name of the run
+	/// @param[in] model shared model
+	/// @param[in] frames frames processed by every stream
+	/// @param[in] nStreams number of concurrent streams
+	/// @param[in] doTrack whether to use tracking
+	/// @param[in] pool workers running the streams when there are several
+	/// @return the results of the run
+	RunResult run(const std::string& name, std::shared_ptr<const DetectorModel> model, const std::vector<cv::Mat>& frames, int nStreams, bool doTrack, ThreadPool& pool)
+	{
+		RunResult result = { name, nStreams, doTrack, 0., DetectionStats(), 0 };
+		std::clog << "Running " << name << "..." << std::endl;
+		const auto start = std::chrono::steady_clock::now();
+		if (1 == nStreams)
+		{
+			result.stats = runStream(model, frames, doTrack);
+		}
+		else
+		{
+			std::vector<std::future<DetectionStats>> streams;
+			for (int k = 0; k < nStreams; ++k)
+				streams.push_back(pool.submit([model, &frames, doTrack](){ return runStream(model, frames, doTrack); }));
+			for (auto& s : streams)
+				result.stats.merge(s.get());
+		}
+		result.wallSeconds = elapsedMilliseconds(start) / 1000.;
+		result.peakRssKB = peakRssKB();
+		return result;
+	}
+
+	/// Writes the report of all runs as JSON
+	/// @param[in] out output stream
+	/// @param[in] options benchmark options
+	/// @param[in] frameSize size of the frames
+	/// @param[in] nFrames number of frames per stream
+	/// @param[in] runs results of the runs
+	void writeReport(std::ostream& out, const Options& options, const cv::Size& frameSize, std::size_t nFrames, const std::vector<RunResult>& runs)
+	{
+		out << "{\n";
+		out << "  \"version\": \"" << SIGNFINDER_VERSION << "\",\n";
+		out << "  \"config\": \"" << options.configFile << "\",\n";
+		out << "  \"source\": \"" << (options.input.empty() ? "synthetic" : "video") << "\",\n";
+		out << "  \"frames\": " << nFrames << ",\n";
+		out << "  \"frameSize\": [" << frameSize.width << ", " << frameSize.height << "],\n";
+		out << "  \"hardwareThreads\": " << std::thread::hardware_concurrency() << ",\n";
+		out << "  \"runs\": [\n";
+		for (std::size_t r = 0; r < runs.size(); ++r)
+		{
+			const RunResult& run = runs[r];
+			const DetectionStats& stats = run.stats;
+			out << "    {\n";
+			out << "      \"name\": \"" << run.name << "\",\n";
+			out << "      \"streams\": " << run.nStreams << ",\n";
+			out << "      \"tracking\": " << (run.doTrack ? "true" : "false") << ",\n";
+			out << "      \"wallSeconds\": " << run.wallSeconds << ",\n";
+			out << "      \"throughputFps\": " << (run.wallSeconds > 0. ? stats.nFrames / run.wallSeconds : 0.) << ",\n";
+			out << "      \"candidates\": " << stats.nCandidates << ",\n";
+			out << "      \"svmAccepted\": " << stats.nAccepted << ",\n";
+			out << "      \"svmRejected\": " << stats.nRejected << ",\n";
+			out << "      \"averageTracks\": " << (stats.nFrames > 0 ? (double)stats.nTrackFrames / stats.nFrames : 0.) << ",\n";
+			out << "      \"peakRssKB\": " << run.peakRssKB << ",\n";
+			out << "      \"stagesMs\": {\n";
+			for (int s = 0; s < DetectionStats::N_STAGES; ++s)
+			{
+				const LatencyHistogram& h = stats.latencies[s];
+				out << "        \"" << DetectionStats::stageName((DetectionStats::Stage)s) << "\": { \"count\": " << h.count()
+					<< ", \"mean\": " << h.mean() << ", \"p50\": " << h.percentile(50.) << ", \"p95\": " << h.percentile(95.)
+					<< ", \"p99\": " << h.percentile(99.) << ", \"max\": " << h.max() << " }" << (s + 1 < DetectionStats::N_STAGES ? ",\n" : "\n");
+			}
+			out << "      }\n";
+			out << "    }" << (r + 1 < runs.size() ? ",\n" : "\n");
+		}
+		out << "  ]\n";
+		out << "}" << std::endl;
+	}
+}   //::<anon>
+
+/// Main entry point
+/// @param[in] argc number of command line arguments (including program name)
+/// @param[in] argv list of arguments
+/// @return EXIT_SUCCESS if the benchmark completes successfully, EXIT_FAILURE if an error occurs.
+int main(int argc, char* argv[])
+{
+	try
+	{
+		const Options options = parseOptions(argc, argv);
+		const std::vector<cv::Mat> frames = (options.input.empty() ? synthesizeFrames(options) : decodeFrames(options));
+		auto model = std::make_shared<const DetectorModel>(options.configFile);
+		ThreadPool pool(options.nJobs);
+
+		std::vector<RunResult> runs;
+		runs.push_back(run("single_track", model, frames, 1, true, pool));
+		runs.push_back(run("single_notrack", model, frames, 1, false, pool));
+		if (options.nStreams > 1)
+		{
+			runs.push_back(run("multi_track", model, frames, options.nStreams, true, pool));
+			runs.push_back(run("multi_notrack", model, frames, options.nStreams, false, pool));
+		}
+
+		if (options.output.empty())
+		{
+			writeReport(std::cout, options, frames.front().size(), frames.size(), runs);
+		}
+		else
+		{
+			std::ofstream out(options.output);
+			if (!out.is_open())
+				throw std::runtime_error("Unable to open report file " + options.output);
+			writeReport(out, options, frames.front().size(), frames.size(), runs);
+		}
+		return EXIT_SUCCESS;
+	}
+	catch (std::exception& err)
+	{
+		std::cerr << err.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
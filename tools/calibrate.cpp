@@ -0,0 +1,269 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "DetectionStats.h"
+#include "DetectorModel.h"
+#include "version.h"
+
+namespace
+{
+	/// Parameters and command line arguments
+	struct Options
+	{
+		std::string configFile;         //< The configuration file in YAML format
+		std::string positivesDir;       //< directory of sign patches
+		std::string negativesDir;       //< directory of background patches
+		std::string output;             //< if non-empty, the Quantization section is written to this file
+		double percentile;              //< percentile of the descriptor values mapped to the largest quantized value
+	};
+
+	/// Sample patch
+	struct Sample
+	{
+		cv::Mat patch;                  //< image
+		int truth;                      //< 1 for a sign, -1 for background
+	};
+
+	/// Comparison of the floating point and quantized versions of a classifier
+	struct Comparison
+	{
+		std::size_t nSamples;           //< number of patches classified
+		std::size_t nSameLabel;         //< number of patches given the same label by both versions
+		std::size_t nSameDecision;      //< number of patches accepted or rejected by both versions
+		std::size_t nCorrect[2];        //< number of correct decisions of each version (0: float, 1: quantized)
+		double sumProbDiff;             //< sum of the absolute differences of the probabilities
+		double maxProbDiff;             //< largest absolute difference of the probabilities
+		LatencyHistogram latencies[2];  //< time per patch of each version (ms)
+	};
+
+	/// Prints basic usage to terminal
+	inline void printUsage()
+	{
+		std::cerr << "USAGE: signfinder_calibrate -c configfile [-P positivesDir] [-N negativesDir] [-q percentile] [-o quantization.yaml]" << std::endl;
+	}
+
+	/// Parses command line options
+	/// @param[in] argc number of command line arguments (including program name)
+	/// @param[in] argv list of arguments
+	/// @return an options structure populated by parsing the command line
+	/// @throw runtime_error if there was a problem parsing the command line arguments
+	Options parseOptions(int argc, char* argv[]) throw(std::runtime_error)
+	{
+		const char* keys =
+		{
+			"{ h | help            | false       | print this message                                            }"
+			"{ c | configFile      |             | location of config file                                       }"
+			"{ P | positives       |             | directory of sign patches                                     }"
+			"{ N | negatives       |             | directory of background patches                               }"
+			"{ q | percentile      | 99.99       | percentile of the descriptor values mapped to the largest int8 value}"
+			"{ o | output          |             | writes the Quantization section of the config file here instead of the standard output}"
+		};
+		cv::CommandLineParser parser(argc, argv, keys);
+		if ((1 == argc) || (parser.get<bool>("h")))
+		{
+			printUsage();
+			parser.printParams();
+			std::cout << "SignFinder v" << SIGNFINDER_VERSION << std::endl;
+			exit(EXIT_SUCCESS);
+		}
+
+		Options opts;
+		opts.configFile = parser.get<std::string>("c");
+		if (opts.configFile.empty())
+		{
+			printUsage();
+			throw std::runtime_error("Parser Error :: No configuration file specified.");
+		}
+		opts.positivesDir = parser.get<std::string>("P");
+		opts.negativesDir = parser.get<std::string>("N");
+		if (opts.positivesDir.empty() && opts.negativesDir.empty())
+		{
+			printUsage();
+			throw std::runtime_error("Parser Error :: No sample patches specified.");
+		}
+		opts.output = parser.get<std::string>("o");
+		opts.percentile = parser.get<double>("q");
+		if ((opts.percentile <= 0.) || (opts.percentile > 100.))
+		{
+			throw std::runtime_error("Parser Error :: percentile must be in (0, 100]");
+		}
+		return opts;
+	}
+
+	/// Loads the patches of a directory
+	/// @param[in] dir directory, ignored if empty
+	/// @param[in] truth class of the patches
+	/// @param[in,out] samples receives the patches
+	void loadSamples(const std::string& dir, int truth, std::vector<Sample>& samples)
+	{
+		if (dir.empty())
+			return;
+		std::vector<std::string> fileNames;
+		cv::glob(dir, fileNames);
+		for (const auto& fileName : fileNames)
+		{
+			cv::Mat patch = cv::imread(fileName);
+			if (!patch.empty())
+				samples.push_back({ patch, truth });
+		}
+	}
+
+	/// Finds the quantization scale from the descriptors of the samples
+	/// @param[in] model floating point model
+	/// @param[in] samples sample patches
+	/// @param[in] percentile percentile of the absolute descriptor values mapped to 127
+	/// @return the scale
+	float calibrate(const DetectorModel& model, const std::vector<Sample>& samples, double percentile)
+	{
+		std::vector<float> values;
+		for (const auto& sample : samples)
+		{
+			for (const auto v : model.describe(sample.patch))
+				values.push_back(std::abs(v));
+		}
+		if (values.empty())
+			throw std::runtime_error("The sample patches have no descriptor values");
+		const std::size_t k = std::min(values.size() - 1, (std::size_t)std::floor(percentile / 100. * (values.size() - 1) + .5));
+		std::nth_element(values.begin(), values.begin() + k, values.end());
+		const float maxValue = values[k];
+		if (maxValue <= 0.f)
+			throw std::runtime_error("The sample patches have null descriptors");
+		return 127.f / maxValue;
+	}
+
+	/// Classifies the samples with both versions of a classifier
+	/// @param[in] classify function classifying a patch with one of the versions (0: float, 1: quantized)
+	/// @param[in] samples sample patches
+	/// @param[in] threshold minimum probability of an accepted patch
+	/// @return the comparison
+	template<typename Classify>
+	Comparison compare(Classify classify, const std::vector<Sample>& samples, double threshold)
+	{
+		Comparison c = Comparison();	//value-initialized: counters at zero, empty histograms
+		for (const auto& sample : samples)
+		{
+			std::pair<int, double> results[2];
+			bool isAccepted[2];
+			for (int version = 0; version < 2; ++version)
+			{
+				const auto start = std::chrono::steady_clock::now();
+				results[version] = classify(version, sample.patch);
+				c.latencies[version].add(elapsedMilliseconds(start));
+				isAccepted[version] = (1 == results[version].first) && (results[version].second > threshold);
+				if (isAccepted[version] == (1 == sample.truth))
+					++c.nCorrect[version];
+			}
+			++c.nSamples;
+			if (results[0].first == results[1].first)
+				++c.nSameLabel;
+			if (isAccepted[0] == isAccepted[1])
+				++c.nSameDecision;
+			const double diff = std::abs(results[0].second - results[1].second);
+			c.sumProbDiff += diff;
+			c.maxProbDiff = std::max(c.maxProbDiff, diff);
+		}
+		return c;
+	}
+
+	/// Prints a comparison
+	/// @param[in] out output stream
+	/// @param[in] name name of the classifier
+	/// @param[in] c comparison
+	/// @param[in] hasTruth whether the accuracy against the sample classes is meaningful
+	void printComparison(std::ostream& out, const std::string& name, const Comparison& c, bool hasTruth)
+	{
+		const double n = (double)std::max<std::size_t>(c.nSamples, 1);
+		out << name << ": " << c.nSamples << " patches" << std::endl;
+		out << "    same label:       " << (100. * c.nSameLabel / n) << "%" << std::endl;
+		out << "    same decision:    " << (100. * c.nSameDecision / n) << "%" << std::endl;
+		out << "    probability diff: mean " << (c.sumProbDiff / n) << ", max " << c.maxProbDiff << std::endl;
+		if (hasTruth)
+			out << "    accuracy:         float " << (100. * c.nCorrect[0] / n) << "%, int8 " << (100. * c.nCorrect[1] / n) << "%" << std::endl;
+		out << "    time per patch:   float " << c.latencies[0].mean() << " ms, int8 " << c.latencies[1].mean() << " ms" << std::endl;
+	}
+
+	/// Writes the Quantization section of a config file
+	/// @param[in] out output stream
+	/// @param[in] scale descriptor quantization scale
+	void writeSection(std::ostream& out, float scale)
+	{
+		out << "Quantization:             # int8 SVM inference, found by signfinder_calibrate" << std::endl;
+		out << "    enabled: 1" << std::endl;
+		out << "    scale: " << scale << std::endl;
+	}
+}   //::<anon>
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		const Options options = parseOptions(argc, argv);
+		std::vector<Sample> samples;
+		loadSamples(options.positivesDir, 1, samples);
+		loadSamples(options.negativesDir, -1, samples);
+		if (samples.empty())
+			throw std::runtime_error("No sample patch found");
+
+		DetectionParams params(options.configFile);
+		params.quantizeSVM = false;
+		const DetectorModel floatModel(params);
+		const float scale = calibrate(floatModel, samples, options.percentile);
+		params.quantizeSVM = true;
+		params.svmQuantizationScale = scale;
+		const DetectorModel quantizedModel(params);
+		const DetectorModel* models[2] = { &floatModel, &quantizedModel };
+
+		//accuracy is only meaningful against the sample classes with both kinds of patches
+		const bool hasTruth = !options.positivesDir.empty() && !options.negativesDir.empty();
+		std::cout << "Descriptor scale: " << scale << " (" << options.percentile << "th percentile of " << samples.size() << " patches)" << std::endl;
+		const Comparison stage2 = compare([&](int version, const cv::Mat& patch) { return models[version]->classify(patch); }, samples, params.SVMThreshold);
+		printComparison(std::cout, "Second stage " + params.svmModelFile, stage2, hasTruth);
+		if (params.useThreeStages())
+		{
+			//the third stage labels the signs, it has no threshold
+			const Comparison stage3 = compare([&](int version, const cv::Mat& patch) { return models[version]->classifyStage3(patch); }, samples, 0.);
+			printComparison(std::cout, "Third stage " + params.svmModelFile2, stage3, false);
+		}
+
+		if (options.output.empty())
+		{
+			std::cout << std::endl;
+			writeSection(std::cout, scale);
+		}
+		else
+		{
+			std::ofstream out(options.output);
+			if (!out.is_open())
+				throw std::runtime_error("Unable to open output file " + options.output);
+			writeSection(out, scale);
+		}
+		return EXIT_SUCCESS;
+	}
+	catch (std::exception& err)
+	{
+		std::cerr << err.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,152 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "opencv2/core/core.hpp"
+#include "DetectionParams.h"
+#include "Evaluation.h"
+#include "version.h"
+
+namespace
+{
+	/// Parameters and command line arguments
+	struct Options
+	{
+		std::string configFile;         //< The configuration file in YAML format
+		std::string input;              //< video to replay
+		std::string truthFile;          //< annotations, in the ROIs file format
+		std::string output;             //< if non-empty, the table is written to this file instead of the standard output
+		int maxDim;                     //< maximum dimension of the frames in pixels
+		int nFrames;                    //< maximum number of frames to replay (0: all)
+		double minIoU;                  //< minimum intersection over union of a match
+		Sweep sweep;                    //< values of the parameters to evaluate
+	};
+
+	/// Prints basic usage to terminal
+	inline void printUsage()
+	{
+		std::cerr << "USAGE: signfinder_eval -c configfile -i video -g truth.txt [-m maxdim] [-n frames] [-u iou] [-T track,notrack] [-S cascadeScales] [-F scaleFactors] [-t thresholds] [-W windowScales] [-X maxWindowFactors] [-Q quantize] [-D deadlines] [-o table.txt]" << std::endl;
+	}
+
+	/// Parses command line options
+	/// @param[in] argc number of command line arguments (including program name)
+	/// @param[in] argv list of arguments
+	/// @return an options structure populated by parsing the command line
+	/// @throw runtime_error if there was a problem parsing the command line arguments
+	Options parseOptions(int argc, char* argv[]) throw(std::runtime_error)
+	{
+		const char* keys =
+		{
+			"{ h | help            | false       | print this message                                            }"
+			"{ c | configFile      |             | location of config file                                       }"
+			"{ i | input           |             | video to replay                                               }"
+			"{ g | truth           |             | annotations of the video, in the ROIs file format             }"
+			"{ m | maxdim          | 640         | maximum dimension of the frames, as in SignFinder             }"
+			"{ n | frames          | 0           | maximum number of frames to replay (0: all)                   }"
+			"{ u | iou             | 0.5         | minimum intersection over union of a detection and an annotation}"
+			"{ T | track           | track       | tracking modes to evaluate: track, notrack or track,notrack   }"
+			"{ S | cascadeScale    |             | comma separated cascade scale factors to evaluate              }"
+			"{ F | scale           |             | comma separated frame rescaling factors to evaluate            }"
+			"{ t | threshold       |             | comma separated SVM thresholds to evaluate                     }"
+			"{ W | window          |             | comma separated factors of the cascade window sizes to evaluate}"
+			"{ X | maxWindow       |             | comma separated maximum cascade windows, as multiples of the minimum one}"
+			"{ Q | quantize        |             | SVM precisions to evaluate: 0 float, 1 int8, or 0,1           }"
+			"{ D | deadline        |             | comma separated real-time deadlines in ms to evaluate (0: off) }"
+			"{ o | output          |             | writes the table to this file instead of the standard output }"
+		};
+		cv::CommandLineParser parser(argc, argv, keys);
+		if ((1 == argc) || (parser.get<bool>("h")))
+		{
+			printUsage();
+			parser.printParams();
+			std::cout << "SignFinder v" << SIGNFINDER_VERSION << std::endl;
+			exit(EXIT_SUCCESS);
+		}
+
+		Options opts;
+		opts.configFile = parser.get<std::string>("c");
+		opts.input = parser.get<std::string>("i");
+		opts.truthFile = parser.get<std::string>("g");
+		if (opts.configFile.empty() || opts.input.empty() || opts.truthFile.empty())
+		{
+			printUsage();
+			throw std::runtime_error("Parser Error :: The configuration file, the input and the annotations are required.");
+		}
+		opts.output = parser.get<std::string>("o");
+		opts.maxDim = parser.get<int>("m");
+		opts.nFrames = parser.get<int>("n");
+		opts.minIoU = parser.get<double>("u");
+		if ((opts.maxDim < 16) || (opts.nFrames < 0) || (opts.minIoU <= 0.) || (opts.minIoU > 1.))
+		{
+			throw std::runtime_error("Parser Error :: maxdim must be at least 16, frames not negative, and iou in (0, 1]");
+		}
+		for (const auto& mode : parseList<std::string>(parser.get<std::string>("T")))
+		{
+			if ((mode != "track") && (mode != "notrack"))
+				throw std::runtime_error("Parser Error :: Unknown tracking mode " + mode);
+			opts.sweep.trackModes.push_back(mode == "track" ? 1 : 0);
+		}
+		opts.sweep.cascadeScaleFactors = parseList<float>(parser.get<std::string>("S"));
+		opts.sweep.scalingFactors = parseList<float>(parser.get<std::string>("F"));
+		opts.sweep.svmThresholds = parseList<float>(parser.get<std::string>("t"));
+		opts.sweep.minWinScales = parseList<float>(parser.get<std::string>("W"));
+		opts.sweep.maxWinFactors = parseList<float>(parser.get<std::string>("X"));
+		opts.sweep.quantizeModes = parseList<int>(parser.get<std::string>("Q"));
+		opts.sweep.deadlines = parseList<double>(parser.get<std::string>("D"));
+		return opts;
+	}
+}   //::<anon>
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		const Options options = parseOptions(argc, argv);
+		const RoiFile truth = readRoiFile(options.truthFile);
+		const std::vector<cv::Mat> frames = loadClip(options.input, options.maxDim, options.nFrames);
+		const DetectionParams params(options.configFile);
+		const auto settings = makeSettings(params, options.sweep);
+
+		//settings run one after the other, so that their timings do not interfere
+		std::vector<EvaluationResult> results;
+		for (const auto& setting : settings)
+		{
+			std::clog << "Evaluating " << setting.name << " (" << (results.size() + 1) << "/" << settings.size() << ")" << std::endl;
+			results.push_back(evaluate(setting, frames, truth, options.minIoU));
+		}
+
+		if (options.output.empty())
+		{
+			printResults(std::cout, results);
+		}
+		else
+		{
+			std::ofstream out(options.output);
+			if (!out.is_open())
+				throw std::runtime_error("Unable to open output file " + options.output);
+			printResults(out, results);
+		}
+		return EXIT_SUCCESS;
+	}
+	catch (std::exception& err)
+	{
+		std::cerr << err.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,145 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include "DetectionLog.h"
+
+namespace
+{
+	/// Prints basic usage to terminal
+	inline void printUsage()
+	{
+		std::cerr << "USAGE: signfinder_logdump [--json] binLog" << std::endl;
+		std::cerr << "Converts a binary detection log written by SignFinder -b to CSV (default) or JSON on the standard output." << std::endl;
+	}
+
+	/// Escapes a string for inclusion in JSON
+	/// @param[in] s string to escape
+	/// @return quoted, escaped string
+	std::string quoted(const std::string& s)
+	{
+		std::ostringstream out;
+		out << '"';
+		for (const char c : s)
+		{
+			if ((c == '"') || (c == '\\'))
+				out << '\\' << c;
+			else if ((unsigned char)c < 0x20)
+				out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+			else
+				out << c;
+		}
+		out << '"';
+		return out.str();
+	}
+
+	/// @return the hexadecimal representation of a hash
+	std::string toHex(std::uint64_t hash)
+	{
+		std::ostringstream out;
+		out << std::hex << std::setw(16) << std::setfill('0') << hash;
+		return out.str();
+	}
+
+	void dumpCsv(DetectionLogReader& log)
+	{
+		const DetectionLogHeader& header = log.header();
+		std::map<std::int32_t, std::string> labels(header.labels.begin(), header.labels.end());
+		std::cout << "# input: " << header.input << "\n";
+		std::cout << "# frameSize: " << header.frameSize.width << "x" << header.frameSize.height << "\n";
+		std::cout << "# configHash: " << toHex(header.configHash) << "\n";
+		std::cout << "frame,trackId,x,y,width,height,score,labelId,label,flags\n";
+		DetectionRecord r;
+		while (log.read(r))
+		{
+			std::cout << r.frame << "," << r.trackId << "," << r.roi.x << "," << r.roi.y << "," << r.roi.width << "," << r.roi.height << ","
+				<< r.score << "," << r.labelId << "," << labels[r.labelId] << "," << r.flags << "\n";
+		}
+	}
+
+	void dumpJson(DetectionLogReader& log)
+	{
+		const DetectionLogHeader& header = log.header();
+		std::map<std::int32_t, std::string> labels(header.labels.begin(), header.labels.end());
+		std::cout << "{\n";
+		std::cout << "  \"input\": " << quoted(header.input) << ",\n";
+		std::cout << "  \"frameSize\": [" << header.frameSize.width << ", " << header.frameSize.height << "],\n";
+		std::cout << "  \"configHash\": \"" << toHex(header.configHash) << "\",\n";
+		std::cout << "  \"labels\": {";
+		for (std::size_t i = 0; i < header.labels.size(); ++i)
+			std::cout << (i > 0 ? ", " : " ") << "\"" << header.labels[i].first << "\": " << quoted(header.labels[i].second);
+		std::cout << " },\n";
+		std::cout << "  \"detections\": [";
+		DetectionRecord r;
+		bool isFirst = true;
+		while (log.read(r))
+		{
+			std::cout << (isFirst ? "\n" : ",\n") << "    { \"frame\": " << r.frame << ", \"trackId\": " << r.trackId
+				<< ", \"roi\": [" << r.roi.x << ", " << r.roi.y << ", " << r.roi.width << ", " << r.roi.height << "]"
+				<< ", \"score\": " << r.score << ", \"labelId\": " << r.labelId << ", \"label\": " << quoted(labels[r.labelId])
+				<< ", \"flags\": " << r.flags << " }";
+			isFirst = false;
+		}
+		std::cout << (isFirst ? "]\n" : "\n  ]\n") << "}\n";
+	}
+}   //::<anon>
+
+/// Main entry point
+/// @param[in] argc number of command line arguments (including program name)
+/// @param[in] argv list of arguments
+/// @return EXIT_SUCCESS if the log was converted, EXIT_FAILURE if an error occurs.
+int main(int argc, char* argv[])
+{
+	bool isJson = false;
+	std::string fileName;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--json")
+			isJson = true;
+		else if ((arg == "-h") || (arg == "--help"))
+		{
+			printUsage();
+			return EXIT_SUCCESS;
+		}
+		else
+			fileName = arg;
+	}
+	if (fileName.empty())
+	{
+		printUsage();
+		return EXIT_FAILURE;
+	}
+
+	try
+	{
+		DetectionLogReader log(fileName);
+		if (isJson)
+			dumpJson(log);
+		else
+			dumpCsv(log);
+		return EXIT_SUCCESS;
+	}
+	catch (std::exception& err)
+	{
+		std::cerr << err.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
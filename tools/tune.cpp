@@ -0,0 +1,311 @@
+/*
+Copyright 2015 The Smith-Kettlewell Eye Research Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "opencv2/core/core.hpp"
+#include "DetectionParams.h"
+#include "Evaluation.h"
+#include "ThreadPool.h"
+#include "version.h"
+
+namespace
+{
+	static const double FPS_TOLERANCE = .03;	//< settings this close to the fastest one are considered as fast, the most accurate is chosen
+
+	/// Parameters and command line arguments
+	struct Options
+	{
+		std::string configFile;         //< The configuration file in YAML format
+		std::string clipList;           //< list of annotated clips
+		std::string output;             //< tuned configuration file
+		double targetRecall;            //< minimum recall of the tuned configuration
+		double minIoU;                  //< minimum intersection over union of a match
+		int maxDim;                     //< maximum dimension of the frames in deployment, as SignFinder -m
+		int nFrames;                    //< maximum number of frames per clip (0: all)
+		int nJobs;                      //< number of settings evaluated concurrently (0: one per hardware thread)
+		int nRetimed;                   //< number of candidates timed again one at a time
+		std::vector<int> maxDims;       //< processing sizes to evaluate, folded into the rescaling factor
+		Sweep sweep;                    //< values of the parameters to evaluate
+	};
+
+	/// Prints basic usage to terminal
+	inline void printUsage()
+	{
+		std::cerr << "USAGE: signfinder_tune -c configfile -L clips.txt -o tuned.yaml [-r recall] [-u iou] [-m maxdim] [-n frames] [-j jobs] [-k retimed] [-T track] [-S cascadeScales] [-F scaleFactors] [-M maxdims] [-t thresholds] [-W windowScales] [-X maxWindowFactors]" << std::endl;
+	}
+
+	/// Parses command line options
+	/// @param[in] argc number of command line arguments (including program name)
+	/// @param[in] argv list of arguments
+	/// @return an options structure populated by parsing the command line
+	/// @throw runtime_error if there was a problem parsing the command line arguments
+	Options parseOptions(int argc, char* argv[]) throw(std::runtime_error)
+	{
+		const char* keys =
+		{
+			"{ h | help            | false       | print this message                                            }"
+			"{ c | configFile      |             | location of config file                                       }"
+			"{ L | clips           |             | list of annotated clips, one 'video rois.txt' pair per line   }"
+			"{ o | output          |             | tuned configuration file                                      }"
+			"{ r | recall          | 0.9         | minimum recall of the tuned configuration                     }"
+			"{ u | iou             | 0.5         | minimum intersection over union of a detection and an annotation}"
+			"{ m | maxdim          | 640         | maximum dimension of the frames in deployment, as in SignFinder}"
+			"{ n | frames          | 0           | maximum number of frames per clip (0: all)                    }"
+			"{ j | jobs            | 0           | number of settings evaluated concurrently (0: one per hardware thread)}"
+			"{ k | retimed         | 5           | number of the fastest candidates timed again one at a time    }"
+			"{ T | track           | track       | tracking modes to evaluate: track, notrack or track,notrack   }"
+			"{ S | cascadeScale    | 1.1,1.2,1.3,1.5 | comma separated cascade scale factors                     }"
+			"{ F | scale           |             | comma separated frame rescaling factors (default: as in the config file)}"
+			"{ M | maxdims         |             | comma separated processing sizes, folded into the rescaling factor}"
+			"{ t | threshold       |             | comma separated SVM thresholds (default: as in the config file)}"
+			"{ W | window          | 0.75,1,1.5  | comma separated factors of the minimum cascade window         }"
+			"{ X | maxWindow       | 4,8         | comma separated maximum cascade windows, as multiples of the minimum one}"
+		};
+		cv::CommandLineParser parser(argc, argv, keys);
+		if ((1 == argc) || (parser.get<bool>("h")))
+		{
+			printUsage();
+			parser.printParams();
+			std::cout << "SignFinder v" << SIGNFINDER_VERSION << std::endl;
+			exit(EXIT_SUCCESS);
+		}
+
+		Options opts;
+		opts.configFile = parser.get<std::string>("c");
+		opts.clipList = parser.get<std::string>("L");
+		opts.output = parser.get<std::string>("o");
+		if (opts.configFile.empty() || opts.clipList.empty() || opts.output.empty())
+		{
+			printUsage();
+			throw std::runtime_error("Parser Error :: The configuration file, the clip list and the output file are required.");
+		}
+		opts.targetRecall = parser.get<double>("r");
+		opts.minIoU = parser.get<double>("u");
+		opts.maxDim = parser.get<int>("m");
+		opts.nFrames = parser.get<int>("n");
+		opts.nJobs = parser.get<int>("j");
+		opts.nRetimed = parser.get<int>("k");
+		if ((opts.targetRecall < 0.) || (opts.targetRecall > 1.) || (opts.minIoU <= 0.) || (opts.minIoU > 1.) ||
+			(opts.maxDim < 16) || (opts.nFrames < 0) || (opts.nJobs < 0) || (opts.nRetimed < 1))
+		{
+			throw std::runtime_error("Parser Error :: recall must be in [0, 1], iou in (0, 1], maxdim at least 16, frames and jobs not negative, and retimed at least 1");
+		}
+		for (const auto& mode : parseList<std::string>(parser.get<std::string>("T")))
+		{
+			if ((mode != "track") && (mode != "notrack"))
+				throw std::runtime_error("Parser Error :: Unknown tracking mode " + mode);
+			opts.sweep.trackModes.push_back(mode == "track" ? 1 : 0);
+		}
+		opts.sweep.cascadeScaleFactors = parseList<float>(parser.get<std::string>("S"));
+		opts.sweep.scalingFactors = parseList<float>(parser.get<std::string>("F"));
+		opts.maxDims = parseList<int>(parser.get<std::string>("M"));
+		opts.sweep.svmThresholds = parseList<float>(parser.get<std::string>("t"));
+		opts.sweep.minWinScales = parseList<float>(parser.get<std::string>("W"));
+		opts.sweep.maxWinFactors = parseList<float>(parser.get<std::string>("X"));
+		return opts;
+	}
+
+	/// Replaces the value of a top-level key of a YAML file, keeping its comment, or appends the key if it is missing
+	/// @param[in,out] lines lines of the file
+	/// @param[in] key key
+	/// @param[in] value new value
+	void setValue(std::vector<std::string>& lines, const std::string& key, const std::string& value)
+	{
+		for (auto& line : lines)
+		{
+			if (0 != line.compare(0, key.size() + 1, key + ":"))
+				continue;
+			const std::size_t comment = line.find('#');
+			line = key + ": " + value + (comment == std::string::npos ? std::string() : "    " + line.substr(comment));
+			return;
+		}
+		lines.push_back(key + ": " + value);
+	}
+
+	/// Replaces the value of a key of a top-level map of a YAML file, keeping its comment, or adds the key if it is missing
+	/// @param[in,out] lines lines of the file
+	/// @param[in] parent key of the map
+	/// @param[in] key key in the map
+	/// @param[in] value new value
+	void setValue(std::vector<std::string>& lines, const std::string& parent, const std::string& key, const std::string& value)
+	{
+		auto it = std::find_if(lines.begin(), lines.end(), [&parent](const std::string& line){ return 0 == line.compare(0, parent.size() + 1, parent + ":"); });
+		if (it == lines.end())
+		{
+			lines.push_back(parent + ":");
+			lines.push_back("    " + key + ": " + value);
+			return;
+		}
+		const auto first = ++it;
+		for (; (it != lines.end()) && (it->empty() || (' ' == (*it)[0])); ++it)
+		{
+			const std::size_t indent = it->find_first_not_of(' ');
+			if ((indent == std::string::npos) || (0 != it->compare(indent, key.size() + 1, key + ":")))
+				continue;
+			const std::size_t comment = it->find('#');
+			*it = it->substr(0, indent) + key + ": " + value + (comment == std::string::npos ? std::string() : "    " + it->substr(comment));
+			return;
+		}
+		lines.insert(first, "    " + key + ": " + value);
+	}
+
+	/// @return value as a string
+	template<typename T>
+	std::string toString(T value)
+	{
+		std::ostringstream text;
+		text << value;
+		return text.str();
+	}
+
+	/// Writes a copy of the configuration file with the tuned parameters
+	/// @param[in] configFile original configuration file
+	/// @param[in] outputFile tuned configuration file
+	/// @param[in] params tuned parameters
+	/// @param[in] summary comment describing the tuning, written at the top of the file
+	/// @throw runtime_error if a file cannot be read or written
+	void writeTunedConfig(const std::string& configFile, const std::string& outputFile, const DetectionParams& params, const std::string& summary) throw(std::runtime_error)
+	{
+		std::ifstream in(configFile, std::ios::in | std::ios::binary);
+		if (!in.is_open())
+			throw std::runtime_error("Unable to open configuration file " + configFile);
+		std::vector<std::string> lines;
+		std::string line;
+		bool hasCarriageReturns = false;	//the line endings of the original are kept
+		while (std::getline(in, line))
+		{
+			if (!line.empty() && ('\r' == line.back()))
+			{
+				line.pop_back();
+				hasCarriageReturns = true;
+			}
+			lines.push_back(line);
+		}
+
+		setValue(lines, "minWinSize", "width", toString(params.cascadeMinWin.width));
+		setValue(lines, "minWinSize", "height", toString(params.cascadeMinWin.height));
+		setValue(lines, "CascadeScaleFactor", toString(params.cascadeScaleFactor));
+		setValue(lines, "maxWinSizeFactor", toString((float)params.cascadeMaxWin.width / params.cascadeMinWin.width));
+		setValue(lines, "SVMThreshold", toString(params.SVMThreshold));
+		setValue(lines, "ScaleFactor", toString(params.scalingFactor));
+		//the YAML directive has to stay first
+		lines.insert(lines.begin() + ((!lines.empty() && ('%' == lines.front()[0])) ? 1 : 0), "# " + summary);
+
+		std::ofstream out(outputFile, std::ios::out | std::ios::binary);
+		if (!out.is_open())
+			throw std::runtime_error("Unable to open output file " + outputFile);
+		for (const auto& l : lines)
+			out << l << (hasCarriageReturns ? "\r\n" : "\n");
+	}
+}   //::<anon>
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		Options options = parseOptions(argc, argv);
+		const std::vector<Clip> clips = loadClips(options.clipList, options.maxDim, options.nFrames);
+		const DetectionParams params(options.configFile);
+
+		//processing at a smaller size is the same as rescaling the deployed frames by the ratio of the sizes
+		if (!options.maxDims.empty())
+		{
+			const std::vector<float> scalingFactors = (options.sweep.scalingFactors.empty() ? std::vector<float>(1, params.scalingFactor) : options.sweep.scalingFactors);
+			options.sweep.scalingFactors.clear();
+			for (const auto scalingFactor : scalingFactors)
+			for (const auto maxDim : options.maxDims)
+				options.sweep.scalingFactors.push_back(scalingFactor * maxDim / options.maxDim);
+		}
+		//without a deadline, the latency controller never degrades a run, so accuracy does not depend on the load and all the
+		//settings are screened concurrently. The tuned configuration keeps the deadline of the original one.
+		DetectionParams undeadlined = params;
+		undeadlined.frameDeadline = 0.f;
+		const auto settings = makeSettings(undeadlined, options.sweep);
+
+		std::clog << "Screening " << settings.size() << " settings on " << clips.size() << " clips" << std::endl;
+		std::vector<EvaluationResult> results(settings.size());
+		ThreadPool pool(options.nJobs);
+		pool.parallelFor(settings.size(), [&](std::size_t i)
+		{
+			results[i] = evaluate(settings[i], clips, options.minIoU);
+		});
+		printResults(std::cout, results);
+
+		std::vector<std::size_t> candidates;
+		for (std::size_t i = 0; i < results.size(); ++i)
+		{
+			if (results[i].counts.recall() >= options.targetRecall)
+				candidates.push_back(i);
+		}
+		if (candidates.empty())
+			throw std::runtime_error("No setting reaches a recall of " + toString(options.targetRecall));
+
+		//concurrent runs slow each other down unevenly, so the fastest candidates are timed again one at a time
+		std::sort(candidates.begin(), candidates.end(), [&results](std::size_t i, std::size_t j){ return results[i].stats.fps() > results[j].stats.fps(); });
+		candidates.resize(std::min(candidates.size(), (std::size_t)options.nRetimed));
+		std::vector<EvaluationResult> retimed;
+		for (const auto i : candidates)
+		{
+			std::clog << "Timing " << settings[i].name << std::endl;
+			retimed.push_back(evaluate(settings[i], clips, options.minIoU));
+		}
+		std::cout << std::endl << "Candidates with a recall of at least " << options.targetRecall << ", timed one at a time:" << std::endl;
+		printResults(std::cout, retimed);
+
+		//the target is checked again on the runs the choice is based on
+		std::vector<std::size_t> eligible;
+		double maxFps = 0.;
+		for (std::size_t k = 0; k < retimed.size(); ++k)
+		{
+			if (retimed[k].counts.recall() >= options.targetRecall)
+			{
+				eligible.push_back(k);
+				maxFps = std::max(maxFps, retimed[k].stats.fps());
+			}
+		}
+		if (eligible.empty())
+			throw std::runtime_error("No setting reaches a recall of " + toString(options.targetRecall) + " when timed alone");
+		std::size_t best = eligible.front();
+		for (const auto k : eligible)
+		{
+			if ((retimed[k].stats.fps() >= (1. - FPS_TOLERANCE) * maxFps) &&
+				((retimed[best].stats.fps() < (1. - FPS_TOLERANCE) * maxFps) || (retimed[k].counts.f1() > retimed[best].counts.f1())))
+			{
+				best = k;
+			}
+		}
+
+		const auto& chosen = retimed[best];
+		std::ostringstream summary;
+		summary << "Tuned by signfinder_tune on " << options.clipList << " (" << chosen.name << "): recall " << chosen.counts.recall()
+			<< ", precision " << chosen.counts.precision() << ", " << chosen.stats.fps() << " FPS at maxdim " << options.maxDim;
+		writeTunedConfig(options.configFile, options.output, settings[candidates[best]].params, summary.str());
+		std::cout << std::endl << "Chosen: " << chosen.name << std::endl << "Written to " << options.output << std::endl;
+		if (!settings[candidates[best]].doTrack)
+			std::cout << "Tracking off (-n) was faster" << std::endl;
+		return EXIT_SUCCESS;
+	}
+	catch (std::exception& err)
+	{
+		std::cerr << err.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}